@@ -11,6 +11,8 @@
 #include <cstdlib>
 #include <sys/time.h>
 #include <map>
+#include <vector>
+#include <unordered_map>
 #include "dime.h"
 
 #define Freq 3401 //grep 'cpu MHz' /proc/cpuinfo
@@ -18,6 +20,94 @@
      __asm__ __volatile__("rdtsc" : "=a" (low), "=d" (high))
 
 FILE* Trace_File;
+
+// Profiling mode (-profile csv|bin): instead of disassembling taken branches,
+// count taken and not-taken outcomes of every conditional branch (up to MAX_SLOTS).
+// Each branch gets a dense slot in Trace(); every thread counts in its own
+// cache-aligned arrays indexed by slot, and Fini() sums the threads.
+KNOB<BOOL> KnobShard(KNOB_MODE_WRITEONCE, "pintool", "shard", "0", "Write the trace to one file per thread: branch_dime.out.<thread>");
+KNOB<string> KnobProfile(KNOB_MODE_WRITEONCE, "pintool", "profile", "", "Branch-bias profile instead of trace: csv or bin");
+
+struct BranchCount
+{
+    UINT64 Taken;
+    UINT64 Not_Taken;
+};
+
+struct SlotInfo
+{
+    ADDRINT Addr;//branch address
+    ADDRINT Offset;//image relative address
+    UINT32 Img;//index in Img_Names
+};
+
+static const UINT32 CHUNK_BITS = 12;//slots per chunk = 4096 (64KB)
+static const UINT32 CHUNK_MASK = (1 << CHUNK_BITS) - 1;
+static const UINT32 MAX_CHUNKS = 4096;//up to 16M branch sites
+static const UINT32 MAX_SLOTS = MAX_CHUNKS << CHUNK_BITS;
+static const UINT32 NO_SLOT = 0xFFFFFFFF;//profile full: the branch is not profiled
+
+class BranchProfile
+{
+  public:
+    BranchProfile() { memset(Chunks, 0, sizeof(Chunks)); }
+    BranchCount* Chunks[MAX_CHUNKS];//allocated on first use
+};
+
+BOOL Shard = false;
+BOOL Profile = false;
+string Profile_Format;
+static BranchProfile* Profiles[PIN_MAX_THREADS];//indexed by thread id
+std::unordered_map<ADDRINT, UINT32> Branch_Slots;//branch address -> slot
+vector<SlotInfo> Slots;//slot -> branch info
+vector<string> Img_Names;
+std::map<UINT32, UINT32> Img_Index;//IMG_Id -> index in Img_Names
+
+/* ===================================================================== */
+// returns the slot of the branch, a new one the first time ins is instrumented,
+// NO_SLOT once MAX_SLOTS branches have a slot
+// (instrumentation is serialized by Pin, so no lock is needed)
+static UINT32 get_branch_slot(INS ins, IMG img)
+{
+    ADDRINT addr = INS_Address(ins);
+    auto it = Branch_Slots.find(addr);
+    if (it != Branch_Slots.end())
+        return it->second;
+    if (Slots.size() >= MAX_SLOTS)
+    {
+        static BOOL warned = false;
+        if (!warned)
+            LOG("branch_dime: profile full (" + decstr(MAX_SLOTS) + " branches), new branches are not profiled\n");
+        warned = true;
+        return NO_SLOT;
+    }
+    if (Img_Index.find(IMG_Id(img)) == Img_Index.end())
+    {
+        Img_Index[IMG_Id(img)] = Img_Names.size();
+        Img_Names.push_back(IMG_Name(img));
+    }
+    SlotInfo info;
+    info.Addr = addr;
+    info.Offset = addr - IMG_LowAddress(img);
+    info.Img = Img_Index[IMG_Id(img)];
+    UINT32 slot = Slots.size();
+    Slots.push_back(info);
+    Branch_Slots[addr] = slot;
+    return slot;
+}
+
+static BranchCount* new_chunk(BranchProfile* prof, UINT32 chunk)
+{
+    if (chunk >= MAX_CHUNKS)
+        return NULL;
+    void* mem = NULL;
+    if (posix_memalign(&mem, 64, sizeof(BranchCount) << CHUNK_BITS) != 0)
+        return NULL;
+    memset(mem, 0, sizeof(BranchCount) << CHUNK_BITS);
+    prof->Chunks[chunk] = static_cast<BranchCount*>(mem);
+    return prof->Chunks[chunk];
+}
+
 /* ===================================================================== */
 static char nibble_to_ascii_hex(UINT8 i) {
     if (i<10) return i+'0';
@@ -97,17 +187,46 @@ disassemble(UINT64 start, UINT64 stop) {
 
 /* ===================================================================== */
 
-static VOID AtBranch(ADDRINT ip, ADDRINT target, BOOL taken)
+// With -demote, a demoted site writes its address instead of its disassembly
+// (the scope charges the budget at each return)
+static VOID AtBranch(THREADID tid, ADDRINT ip, ADDRINT target, BOOL taken, DimeSite* site)
 {
-	dime_start_time();
-	if (taken)
-    {
-        string s = disassemble ((ip),(ip)+15);
-        //prints: assembly
+	dime_scope<> scope;
+	if (!taken)
+	{
+		return;
+	}
+	dime_count_event(tid);
+	if (dime_site_demoted(site))
+	{
+        if (Shard)
+            dime_shard_printf(tid, "0x%lx", (unsigned long)ip);
+        else
+            fprintf (Trace_File, "0x%lx\n", (unsigned long)ip);
+        return;
+	}
+    string s = disassemble ((ip),(ip)+15);
+    //prints: assembly
+    if (Shard)
+        dime_shard_printf(tid, "%s", s.c_str());
+    else
         fprintf (Trace_File, "%s\n", s.c_str());
-        //fflush (Trace_File);
-    }
-	dime_end_time();
+    //fflush (Trace_File);
+	scope.sample(site);
+}
+
+static VOID CountBranch(THREADID tid, UINT32 slot, BOOL taken)
+{
+	dime_scope<> scope;
+	BranchCount* chunk = Profiles[tid]->Chunks[slot >> CHUNK_BITS];
+	if (chunk == NULL)
+		chunk = new_chunk(Profiles[tid], slot >> CHUNK_BITS);
+	if (chunk != NULL)
+	{
+		chunk[slot & CHUNK_MASK].Taken += (taken != 0);
+		chunk[slot & CHUNK_MASK].Not_Taken += (taken == 0);
+	}
+	dime_count_event(tid);
 }
 
 /* ===================================================================== */
@@ -115,12 +234,20 @@ static VOID Trace(TRACE trace, VOID *v)
 {
 	IMG img = IMG_FindByAddress(TRACE_Address(trace));
 	if(!IMG_Valid(img)) return;
+	if(!dime_filter_trace(TRACE_Address(trace))) return;//filtered out: no version switch
 	ADDRINT version = TRACE_Version(trace);
+	THREADID thread_id = PIN_ThreadId();
+	char* img_name = (char*)(IMG_Name(img)).c_str();
+	UINT64 trace_key = dime_trace_key(trace, TRACE_Address(trace) - IMG_LowAddress(img));
+	USIZE trace_size = TRACE_Size(trace);
+	//redundancy suppression (-r): a trace in the log of a previous run is not instrumented
+	if(!dime_compare_to_log(thread_id, trace_key, trace_size, img_name)) return;
 	for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
 	{
 		for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
 		{
-			if (INS_IsBranchOrCall(ins))
+			//the profile counts conditional branches only: the others are always taken
+			if (Profile ? (INS_IsBranch(ins) && INS_HasFallThrough(ins)) : INS_IsBranchOrCall(ins))
 			{
 			    dime_switch_version(version, ins);
                 switch(version) {
@@ -128,8 +255,17 @@ static VOID Trace(TRACE trace, VOID *v)
                         //Do Nothing 
                         break;
                     case VERSION_INSTRUMENT:
-				        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)AtBranch, 
-				            IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN , IARG_END);
+                        if (Profile)
+                        {
+                            UINT32 slot = get_branch_slot(ins, img);
+                            if (slot != NO_SLOT)
+                                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountBranch, IARG_THREAD_ID,
+                                    IARG_UINT32, slot, IARG_BRANCH_TAKEN, IARG_END);
+                        }
+                        else
+                            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)AtBranch, IARG_THREAD_ID,
+                                IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN,
+                                IARG_PTR, dime_site(INS_Address(ins)), IARG_END);
                         break;
                     default:
                         assert(0);
@@ -139,11 +275,103 @@ static VOID Trace(TRACE trace, VOID *v)
 			}
 		}
 	}        
+	dime_modify_log(version, thread_id, trace_key, trace_size, img_name);
+}
+
+/* ===================================================================== */
+VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    if (Shard)
+    {
+        dime_thread_start(tid);
+        dime_shard_open(tid, "branch_dime.out");
+    }
+    if (Profile && Profiles[tid] == NULL)
+        Profiles[tid] = new BranchProfile;
+}
+
+VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v)
+{
+    if (Shard)
+        dime_shard_close(tid);
+}
+
+/* ===================================================================== */
+// sums the counts of slot over all threads
+static BranchCount sum_slot(UINT32 slot)
+{
+    BranchCount sum = {0, 0};
+    for (UINT32 t = 0; t < PIN_MAX_THREADS; t++)
+    {
+        if (Profiles[t] == NULL || Profiles[t]->Chunks[slot >> CHUNK_BITS] == NULL)
+            continue;
+        BranchCount* c = &Profiles[t]->Chunks[slot >> CHUNK_BITS][slot & CHUNK_MASK];
+        sum.Taken += c->Taken;
+        sum.Not_Taken += c->Not_Taken;
+    }
+    return sum;
+}
+
+// csv:  one line per branch: address,image,offset,taken,not_taken,est_taken,est_not_taken
+//       (est_: counts extrapolated to full instrumentation, see dime_estimate())
+// bin:  "DIMEBRP1", UINT32 number of images, for each image UINT32 length + name,
+//       UINT64 number of branches, for each branch UINT64 address, UINT64 image index,
+//       UINT64 offset, UINT64 taken, UINT64 not_taken
+static VOID WriteProfile()
+{
+    if (Profile_Format == "bin")
+    {
+        FILE* out = fopen("branch_dime_profile.bin", "wb");
+        if (out == NULL)
+        {
+            LOG("branch_dime: cannot open branch_dime_profile.bin, ErrNo = " + decstr(errno) + "\n");
+            return;
+        }
+        fwrite("DIMEBRP1", 1, 8, out);
+        UINT32 num_imgs = Img_Names.size();
+        fwrite(&num_imgs, sizeof(num_imgs), 1, out);
+        for (UINT32 i = 0; i < num_imgs; i++)
+        {
+            UINT32 len = Img_Names[i].size();
+            fwrite(&len, sizeof(len), 1, out);
+            fwrite(Img_Names[i].c_str(), 1, len, out);
+        }
+        UINT64 num_slots = Slots.size();
+        fwrite(&num_slots, sizeof(num_slots), 1, out);
+        for (UINT32 s = 0; s < Slots.size(); s++)
+        {
+            BranchCount sum = sum_slot(s);
+            UINT64 rec[5] = {Slots[s].Addr, Slots[s].Img, Slots[s].Offset, sum.Taken, sum.Not_Taken};
+            fwrite(rec, sizeof(rec), 1, out);
+        }
+        fclose(out);
+    }
+    else
+    {
+        FILE* out = fopen("branch_dime_profile.csv", "w");
+        if (out == NULL)
+        {
+            LOG("branch_dime: cannot open branch_dime_profile.csv, ErrNo = " + decstr(errno) + "\n");
+            return;
+        }
+        fprintf(out, "address,image,offset,taken,not_taken,est_taken,est_not_taken\n");
+        for (UINT32 s = 0; s < Slots.size(); s++)
+        {
+            BranchCount sum = sum_slot(s);
+            fprintf(out, "0x%lx,%s,0x%lx,%lu,%lu,%.0f,%.0f\n", (unsigned long)Slots[s].Addr,
+                    Img_Names[Slots[s].Img].c_str(), (unsigned long)Slots[s].Offset,
+                    (unsigned long)sum.Taken, (unsigned long)sum.Not_Taken,
+                    dime_estimate(sum.Taken).Value, dime_estimate(sum.Not_Taken).Value);
+        }
+        fclose(out);
+    }
 }
 
 /* ===================================================================== */
 VOID Fini(INT32 code, VOID *v)
 {
+	if (Profile)
+		WriteProfile();
 	fclose(Trace_File);
 	dime_fini();
 }
@@ -154,6 +382,14 @@ int main(INT32 argc, CHAR **argv)
     PIN_Init(argc, argv);
     dime_init();
     Trace_File = fopen("branch_dime.out", "w");	
+    Profile_Format = KnobProfile.Value();
+    Profile = (Profile_Format == "csv" || Profile_Format == "bin");
+    Shard = !Profile && KnobShard.Value();
+    if (Profile || Shard)
+    {
+        PIN_AddThreadStartFunction(ThreadStart, 0);
+        PIN_AddThreadFiniFunction(ThreadFini, 0);
+    }
     PIN_AddFiniFunction(Fini, 0);
     TRACE_AddInstrumentFunction(Trace, 0);
     PIN_StartProgram();
@@ -11,14 +11,143 @@
 #include <time.h>
 #include <unordered_set>
 #include <set>
+#include <map>
+#include <unordered_map>
+#include <string.h>
 #include "dime.h"
 
 // This file is based on debugtrace.cpp in Pin kit
-// Call tracing tool that uses Dime, no redundancy suppression, uni-threaded only.
+// Call tracing tool that uses Dime, with redundancy suppression (-r) and per-thread
+// state, so it can trace multi-threaded applications (use -shard 1 for one file per thread).
+// With -agg 1, the tool does not trace: it counts caller->callee edges in per-thread
+// tables and writes them to call_dime_edges.out at the end.
+
+KNOB<BOOL> KnobAggregate(KNOB_MODE_WRITEONCE, "pintool", "agg", "0", "Aggregate call edge counts instead of tracing every call");
+KNOB<BOOL> KnobInclusive(KNOB_MODE_WRITEONCE, "pintool", "agg_incl", "0", "With -agg: keep a shadow stack for inclusive call counts");
+KNOB<BOOL> KnobShard(KNOB_MODE_WRITEONCE, "pintool", "shard", "0", "Write the trace to one file per thread: call_dime.out.<thread>");
+KNOB<BOOL> KnobDedupe(KNOB_MODE_WRITEONCE, "pintool", "dedupe", "0", "Skip calls and returns that were recently written by the same thread");
 
 string File_Name = "call_dime.out";//output file name
+string Edge_File_Name = "call_dime_edges.out";//output file name of the aggregation mode
 FILE* Trace_File;
 
+/* ===================================================================== */
+// Aggregation mode
+// Each thread counts (call site, target) pairs in a flat open-addressing table.
+// The table is merged into Edges (under Agg_Lock) when it gets half full,
+// when a new period starts, at thread fini and at Fini.
+
+static const UINT32 EDGE_TABLE_SIZE = 1 << 14;//entries per thread, power of 2
+
+struct EdgeSlot
+{
+    ADDRINT Site;//call site address, 0 if slot is empty
+    ADDRINT Target;
+    UINT64 Count;
+};
+
+struct Frame
+{
+    ADDRINT Fn;//entry address of the callee
+    UINT64 Calls_At_Entry;//value of EdgeTable::Calls when the frame was pushed
+};
+
+struct FnStat
+{
+    FnStat() : Depth(0), Inclusive(0) {}
+    UINT32 Depth;//number of active frames of this function (recursion)
+    UINT64 Inclusive;//calls made while the function was active
+};
+
+class EdgeTable
+{
+  public:
+    EdgeTable() : Used(0), Period(0), Calls(0) { memset(Slots, 0, sizeof(Slots)); }
+    EdgeSlot Slots[EDGE_TABLE_SIZE];
+    UINT32 Used;//number of non-empty slots
+    INT64 Period;//value of Period_Seq (period number) when the table was last merged
+    UINT64 Calls;//calls seen by the thread, used by the shadow stack
+    vector<Frame> Stack;//shadow stack (-agg_incl only)
+    std::unordered_map<ADDRINT, FnStat> Fn_Stats;//(-agg_incl only)
+};
+
+BOOL Aggregate = false;
+BOOL Inclusive = false;
+BOOL Dedupe = false;
+BOOL Shard = false;
+static TLS_KEY Agg_Key;
+PIN_LOCK Agg_Lock;
+vector<EdgeTable*> Agg_Tables;//tables of all threads, for Fini
+std::map<std::pair<ADDRINT,ADDRINT>, UINT64> Edges;//merged edge counts
+std::map<ADDRINT, char> Site_Kinds;//call site -> 'C', 'T' or 'P', filled at instrumentation time
+std::map<ADDRINT, UINT64> Inclusive_Calls;//merged inclusive counts
+
+static inline UINT32 edge_hash(ADDRINT site, ADDRINT target)
+{
+    UINT64 h = (UINT64)site ^ ((UINT64)target * 0x9E3779B97F4A7C15ULL);
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return (UINT32)h & (EDGE_TABLE_SIZE - 1);
+}
+
+// moves the counts of one thread table into Edges and empties the table
+VOID MergeEdgeTable(EdgeTable* table, THREADID threadid)
+{
+    GetLock(&Agg_Lock, threadid+1);
+    for (UINT32 i = 0; i < EDGE_TABLE_SIZE; i++)
+    {
+        EdgeSlot* slot = &table->Slots[i];
+        if (slot->Site == 0) continue;
+        Edges[std::make_pair(slot->Site, slot->Target)] += slot->Count;
+    }
+    for (auto it = table->Fn_Stats.begin(); it != table->Fn_Stats.end(); ++it)
+    {
+        Inclusive_Calls[it->first] += it->second.Inclusive;
+        it->second.Inclusive = 0;
+    }
+    ReleaseLock(&Agg_Lock);
+    memset(table->Slots, 0, sizeof(table->Slots));
+    table->Used = 0;
+    table->Period = Period_Seq;
+}
+
+static inline VOID AddEdge(EdgeTable* table, THREADID threadid, ADDRINT site, ADDRINT target)
+{
+    if (table->Period != Period_Seq || table->Used * 2 >= EDGE_TABLE_SIZE)
+        MergeEdgeTable(table, threadid);
+    UINT32 i = edge_hash(site, target);
+    while (table->Slots[i].Site != 0 && (table->Slots[i].Site != site || table->Slots[i].Target != target))
+        i = (i + 1) & (EDGE_TABLE_SIZE - 1);
+    if (table->Slots[i].Site == 0)
+    {
+        table->Slots[i].Site = site;
+        table->Slots[i].Target = target;
+        table->Used++;
+    }
+    table->Slots[i].Count++;
+}
+
+// shadow stack: closes the top frame
+static inline VOID PopFrame(EdgeTable* table)
+{
+    Frame& f = table->Stack.back();
+    FnStat& stat = table->Fn_Stats[f.Fn];
+    stat.Depth--;
+    if (stat.Depth == 0)//count recursive activations once
+        stat.Inclusive += table->Calls - f.Calls_At_Entry;
+    table->Stack.pop_back();
+}
+
+static inline VOID PushFrame(EdgeTable* table, ADDRINT fn)
+{
+    Frame f;
+    f.Fn = fn;
+    f.Calls_At_Entry = table->Calls;
+    table->Fn_Stats[fn].Depth++;
+    table->Stack.push_back(f);
+}
+
 /* ===================================================================== */
 
 string FormatAddress(ADDRINT address, RTN rtn)
@@ -40,35 +169,140 @@ string FormatAddress(ADDRINT address, RTN rtn)
 
 /* ===================================================================== */
 // Analysis Routines
+// With -dedupe, the string of a site (unique per site) is the key of the event
 VOID EmitDirectCall(THREADID threadid, string * str, INT32 tailCall)
 {
-    dime_start_time();
-    fprintf(Trace_File, "%s\n", (*str).c_str() ); 
-    dime_end_time();   
+    dime_scope<> scope;
+    if (!Dedupe || !dime_seen(threadid, (UINT64)str))
+    {
+        if (Shard)
+            dime_shard_printf(threadid, "%s", (*str).c_str());
+        else
+            fprintf(Trace_File, "%s\n", (*str).c_str() ); 
+    }
+    dime_count_event(threadid);
 }
 
 
-VOID EmitIndirectCall(THREADID threadid, string * str, ADDRINT target)
+// With -demote, a demoted site writes the raw target address instead of looking up its symbol
+// (the scope charges the budget at each return)
+VOID EmitIndirectCall(THREADID threadid, string * str, ADDRINT target, DimeSite* site)
 {
-    dime_start_time();
+    dime_scope<> scope;
+    dime_count_event(threadid);
+    if (Dedupe && dime_seen(threadid, dime_key((UINT64)str, target)))
+    {
+        return;
+    }
+    if (dime_site_demoted(site))
+    {
+        if (Shard)
+            dime_shard_printf(threadid, "%s 0x%lx", (*str).c_str(), (unsigned long)target);
+        else
+            fprintf(Trace_File, "%s 0x%lx\n", (*str).c_str(), (unsigned long)target);
+        return;
+    }
     PIN_LockClient();
     string s = FormatAddress(target, RTN_FindByAddress(target));
     PIN_UnlockClient();
-	fprintf(Trace_File, "%s%s\n", (*str).c_str(), s.c_str() );
-	dime_end_time();
+    if (Shard)
+        dime_shard_printf(threadid, "%s%s", (*str).c_str(), s.c_str());
+    else
+        fprintf(Trace_File, "%s%s\n", (*str).c_str(), s.c_str() );
+    scope.sample(site);
 }
 
 VOID EmitReturn(THREADID threadid, string * str)
 {
-    dime_start_time();
-    fprintf(Trace_File, "%s\n", (*str).c_str() );
-    dime_end_time();
+    dime_scope<> scope;
+    if (!Dedupe || !dime_seen(threadid, (UINT64)str))
+    {
+        if (Shard)
+            dime_shard_printf(threadid, "%s", (*str).c_str());
+        else
+            fprintf(Trace_File, "%s\n", (*str).c_str() );
+    }
+    dime_count_event(threadid);
+}
+
+// Analysis routines of the aggregation mode
+VOID AggCall(THREADID threadid, ADDRINT site, ADDRINT target, UINT32 kind)
+{
+    dime_scope<> scope;
+    EdgeTable* table = static_cast<EdgeTable*>(PIN_GetThreadData(Agg_Key, threadid));
+    AddEdge(table, threadid, site, target);
+    dime_count_event(threadid);
+    if (Inclusive)
+    {
+        table->Calls++;
+        if (kind == 'T' && !table->Stack.empty())//tail call replaces the caller frame
+            PopFrame(table);
+        if (kind != 'P')//no frame for pc materialization
+            PushFrame(table, target);
+    }
+}
+
+VOID AggReturn(THREADID threadid, ADDRINT rtn_addr)
+{
+    dime_scope<> scope;
+    EdgeTable* table = static_cast<EdgeTable*>(PIN_GetThreadData(Agg_Key, threadid));
+    // calls executed in the base version are not seen, so pop up to the
+    // frame of the returning routine and ignore returns without a frame
+    UINT32 depth = table->Fn_Stats.count(rtn_addr) ? table->Fn_Stats[rtn_addr].Depth : 0;
+    if (depth > 0)
+    {
+        while (table->Stack.back().Fn != rtn_addr)
+            PopFrame(table);
+        PopFrame(table);
+    }
+}
+
+/* ===================================================================== */
+
+// instrumentation of the aggregation mode
+VOID AggCallTrace(TRACE trace, INS ins)
+{
+    if (INS_IsCall(ins) && !INS_IsDirectBranchOrCall(ins))
+    {
+        // Indirect call
+        Site_Kinds[INS_Address(ins)] = 'C';
+        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, AFUNPTR(AggCall), IARG_THREAD_ID,
+                       IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_UINT32, (UINT32)'C', IARG_END);
+    }
+    else if (INS_IsDirectBranchOrCall(ins))
+    {
+        ADDRINT target = INS_DirectBranchOrCallTargetAddress(ins);
+        RTN sourceRtn = TRACE_Rtn(trace);
+        RTN destRtn = RTN_FindByAddress(target);
+        if (INS_IsCall(ins) || sourceRtn != destRtn)
+        {
+            char kind = 'T';
+            if (INS_IsCall(ins))
+                kind = INS_IsProcedureCall(ins) ? 'C' : 'P';
+            Site_Kinds[INS_Address(ins)] = kind;
+            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, AFUNPTR(AggCall), IARG_THREAD_ID,
+                           IARG_INST_PTR, IARG_ADDRINT, target, IARG_UINT32, (UINT32)kind, IARG_END);
+        }
+    }
+    else if (INS_IsRet(ins) && Inclusive)
+    {
+        RTN rtn = TRACE_Rtn(trace);
+        if (!RTN_Valid(rtn)) return;
+        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, AFUNPTR(AggReturn), IARG_THREAD_ID,
+                       IARG_ADDRINT, RTN_Address(rtn), IARG_END);
+    }
 }
 
 /* ===================================================================== */
         
 VOID CallTrace(TRACE trace, INS ins)
 {
+    if (Aggregate)
+    {
+        AggCallTrace(trace, ins);
+        return;
+    }
+
 
     if (INS_IsCall(ins) && !INS_IsDirectBranchOrCall(ins))
     {
@@ -76,7 +310,7 @@ VOID CallTrace(TRACE trace, INS ins)
         string s = "C" + FormatAddress(INS_Address(ins), TRACE_Rtn(trace));
         s += " ";
         INS_InsertPredicatedCall(ins, IPOINT_BEFORE, AFUNPTR(EmitIndirectCall), IARG_THREAD_ID,
-                       IARG_PTR, new string(s), IARG_BRANCH_TARGET_ADDR, IARG_END);
+                       IARG_PTR, new string(s), IARG_BRANCH_TARGET_ADDR, IARG_PTR, dime_site(INS_Address(ins)), IARG_END);
     }
     else if (INS_IsDirectBranchOrCall(ins))
     {
@@ -132,7 +366,15 @@ VOID Trace(TRACE trace, VOID *v)
 	UINT64 trace_addr = TRACE_Address(trace);
 	IMG img = IMG_FindByAddress(trace_addr);
 	if(!IMG_Valid(img)) return;
+	if(!dime_filter_trace(trace_addr)) return;//filtered out: no version switch
 	ADDRINT version = TRACE_Version(trace);
+	THREADID thread_id = PIN_ThreadId();
+	char* img_name = (char*)(IMG_Name(img)).c_str();
+	UINT64 trace_key = dime_trace_key(trace, trace_addr - IMG_LowAddress(img));
+	USIZE trace_size = TRACE_Size(trace);
+	
+	//redundancy suppression (-r): a trace in the log of a previous run is not instrumented
+	if(!dime_compare_to_log(thread_id, trace_key, trace_size, img_name)) return;
 	
     for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
     {
@@ -155,12 +397,84 @@ VOID Trace(TRACE trace, VOID *v)
             }
         }
     }
+	dime_modify_log(version, thread_id, trace_key, trace_size, img_name);
+}
+
+/* ===================================================================== */
+
+VOID ThreadStart(THREADID threadid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    if (Dedupe || Shard)
+        dime_thread_start(threadid);
+    if (Shard)
+        dime_shard_open(threadid, File_Name.c_str());
+    if (!Aggregate)
+        return;
+    EdgeTable* table = new EdgeTable;
+    table->Period = Period_Seq;
+    PIN_SetThreadData(Agg_Key, table, threadid);
+    GetLock(&Agg_Lock, threadid+1);
+    Agg_Tables.push_back(table);
+    ReleaseLock(&Agg_Lock);
+}
+
+VOID ThreadFini(THREADID threadid, const CONTEXT *ctxt, INT32 code, VOID *v)
+{
+    if (Shard)
+        dime_shard_close(threadid);
+    if (!Aggregate)
+        return;
+    EdgeTable* table = static_cast<EdgeTable*>(PIN_GetThreadData(Agg_Key, threadid));
+    while (!table->Stack.empty())//close the frames that are still open
+        PopFrame(table);
+    MergeEdgeTable(table, threadid);
+}
+
+// writes the merged edges: kind site target count caller callee
+VOID WriteEdges()
+{
+    for (size_t t = 0; t < Agg_Tables.size(); t++)
+        MergeEdgeTable(Agg_Tables[t], PIN_ThreadId());
+    FILE* edge_file = fopen(Edge_File_Name.c_str(), "w");
+    if (edge_file == NULL)
+    {
+        LOG("call_dime: cannot open " + Edge_File_Name + ", ErrNo = " + decstr(errno) + "\n");
+        return;
+    }
+    fprintf(edge_file, "# kind site target count estimated_count est_low est_high caller callee\n");
+    PIN_LockClient();
+    for (auto it = Edges.begin(); it != Edges.end(); ++it)
+    {
+        ADDRINT site = it->first.first;
+        ADDRINT target = it->first.second;
+        string caller = FormatAddress(site, RTN_FindByAddress(site));
+        string callee = FormatAddress(target, RTN_FindByAddress(target));
+        DimeEstimate est = dime_estimate(it->second);
+        fprintf(edge_file, "%c 0x%lx 0x%lx %lu %.0f %.0f %.0f%s%s\n", Site_Kinds[site], (unsigned long)site,
+                (unsigned long)target, (unsigned long)it->second, est.Value, est.Low, est.High,
+                caller.c_str(), callee.c_str());
+    }
+    if (Inclusive)
+    {
+        fprintf(edge_file, "# I function inclusive_calls name\n");
+        for (auto it = Inclusive_Calls.begin(); it != Inclusive_Calls.end(); ++it)
+        {
+            string name = FormatAddress(it->first, RTN_FindByAddress(it->first));
+            fprintf(edge_file, "I 0x%lx %lu%s\n", (unsigned long)it->first,
+                    (unsigned long)it->second, name.c_str());
+        }
+    }
+    PIN_UnlockClient();
+    fprintf(edge_file, "# eof");
+    fclose(edge_file);
 }
 
 /* ===================================================================== */
 
 VOID Fini(int, VOID * v)
 {
+	if (Aggregate)
+		WriteEdges();
 	fprintf(Trace_File, "# eof");
 	fclose(Trace_File); 
 	dime_fini(); 	
@@ -174,6 +488,21 @@ int main(int argc, CHAR *argv[])
     
     Trace_File = fopen(File_Name.c_str(), "w");
     
+    Aggregate = KnobAggregate.Value();
+    Inclusive = Aggregate && KnobInclusive.Value();
+    Dedupe = KnobDedupe.Value();
+    Shard = !Aggregate && KnobShard.Value();
+    if (Aggregate)
+    {
+        InitLock(&Agg_Lock);
+        Agg_Key = PIN_CreateThreadDataKey(0);
+    }
+    if (Aggregate || Dedupe || Shard)
+    {
+        PIN_AddThreadStartFunction(ThreadStart, 0);
+        PIN_AddThreadFiniFunction(ThreadFini, 0);
+    }
+    
     TRACE_AddInstrumentFunction(Trace, 0);
     PIN_AddFiniFunction(Fini, 0);
     
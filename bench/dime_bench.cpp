@@ -0,0 +1,399 @@
+/*
+	Microbenchmarks of DIME's hot paths, on the stub backend of dime_platform.h
+	(no Pin kit needed). The output follows Google Benchmark: one line per benchmark
+	and argument, with the time per operation and the iterations that were run.
+
+	To compile:  g++ -O2 -std=c++11 -pthread -I.. -o dime_bench dime_bench.cpp -lrt
+	To run:      dime_bench [-filter <substring>] [-max_entries <N>] [-min_time <sec>]
+	             e.g. dime_bench -filter Log -max_entries 1000000
+	             -max_entries: largest redundancy log of the log benchmarks (default 10M)
+	             -min_time: minimum measured time of each benchmark (default 0.2 sec)
+
+	Benchmarks:
+	- StartEndTime: dime_start_time() + dime_end_time(), the probes around each analysis routine
+	- ScopeRdtsc / ScopeRdtscp / ScopeNone: an empty dime_scope with each probe policy
+	- HasBudget / HasBudgetEmpty / HasBudgetThread: the version-switch check, with budget,
+	  without budget, and with per-thread slices (-steal)
+	- CompareToLog/N, ModifyLog/N: lookups and updates of a redundancy log of N traces
+	- ReadLog/N: parsing of a log file of N lines at image load (also reported in MB/s)
+	- PeriodReset, PeriodResetPaced: the alarm handler, without and with -pace 16
+	Before the benchmarks, the period-reset behaviour is checked (budget refill, pacing
+	slots, carry and period boundaries); a failed check is printed and sets the exit code.
+*/
+
+#define DIME_PLATFORM_STUB
+#include "dime_core.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* ================================================================= */
+/* ---------------------------- Harness ---------------------------- */
+class BenchState
+{
+  public:
+	BenchState(UINT64 iterations, INT64 arg) : Iterations(iterations), Arg(arg), Bytes(0), Left(iterations), Start_Ns(0), End_Ns(0) {}
+	UINT64 Iterations;
+	INT64 Arg;//argument of the benchmark (e.g. log size), 0: none
+	UINT64 Bytes;//bytes processed, for the throughput column
+	// for(; state.KeepRunning(); ) { measured code }
+	bool KeepRunning()
+	{
+		if(Left == Iterations) Start_Ns = now_ns();
+		if(Left-- > 0) return true;
+		End_Ns = now_ns();
+		return false;
+	}
+	double Seconds() const { return (End_Ns - Start_Ns) / 1e9; }
+	// excludes setup done inside the loop
+	void PauseTiming() { Paused_Ns = now_ns(); }
+	void ResumeTiming() { Start_Ns += now_ns() - Paused_Ns; }
+	static UINT64 now_ns()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (UINT64)ts.tv_sec * sec_to_nsec + ts.tv_nsec;
+	}
+  private:
+	UINT64 Left;
+	UINT64 Start_Ns;
+	UINT64 End_Ns;
+	UINT64 Paused_Ns;
+};
+
+typedef void (*BenchFunction)(BenchState&);
+struct Bench
+{
+	const char* Name;
+	BenchFunction Function;
+	std::vector<INT64> Args;//empty: run once without argument
+};
+static std::vector<Bench>& benches()
+{
+	static std::vector<Bench> list;
+	return list;
+}
+struct BenchRegistrar
+{
+	BenchRegistrar(const char* name, BenchFunction function, INT64 range_lo = 0, INT64 range_hi = 0)
+	{
+		Bench b;
+		b.Name = name;
+		b.Function = function;
+		for(INT64 a = range_lo; a > 0 && a <= range_hi; a *= 10) b.Args.push_back(a);
+		benches().push_back(b);
+	}
+};
+// DIME_BENCH(fn): runs fn once; DIME_BENCH_RANGE(fn, lo, hi): runs fn with lo, 10*lo, ... hi
+#define DIME_BENCH(fn) static BenchRegistrar fn##_registrar(#fn, fn)
+#define DIME_BENCH_RANGE(fn, lo, hi) static BenchRegistrar fn##_registrar(#fn, fn, lo, hi)
+
+static double Min_Time = 0.2;//seconds
+static INT64 Max_Entries = 10000000;
+
+/* ----------------------------------------------------------------- */
+// doubles the iterations until the run lasts Min_Time, then prints it
+static void run_bench(const Bench& b, INT64 arg)
+{
+	UINT64 iterations = 1;
+	for(;;)
+	{
+		BenchState state(iterations, arg);
+		b.Function(state);
+		if(state.Seconds() >= Min_Time || iterations >= (1ULL << 34))
+		{
+			string name = b.Name;
+			if(arg > 0) name += "/" + decstr(arg);
+			printf("%-28s %12.2f ns %14llu", name.c_str(), state.Seconds() * 1e9 / iterations, (unsigned long long)iterations);
+			if(state.Bytes > 0) printf(" %10.1f MB/s", state.Bytes / state.Seconds() / 1e6);
+			printf("\n");
+			return;
+		}
+		double grow = (state.Seconds() > 0) ? 1.4 * Min_Time / state.Seconds() : 10;
+		iterations = (UINT64)(iterations * (grow < 10 ? (grow > 2 ? grow : 2) : 10));
+	}
+}
+
+/* ================================================================= */
+/* ------------------------- DIME set-up --------------------------- */
+static char Bench_Img[] = "/bench/libbench.so";
+
+static void bench_reset_budget(float percentage, float period, UINT32 pace)
+{
+	Pace_Slots = pace;
+	dime_set_budget(percentage, period);
+	Budget_Dec = Slot_Budget;
+	Pace_Tick = 0;
+	Paused = false;
+	Period_Start_Tsc = dime_rdtsc64();
+}
+
+static void bench_init()
+{
+	Stub_Log_Quiet = true;
+	InitLock(&Lock);
+	InitLock(&Log_Lock);
+	InitLock(&Site_Lock);
+	Tls_Key = PIN_CreateThreadDataKey(0);
+	Num_Threads = 1;
+	PIN_SetThreadData(Tls_Key, new ThreadData, PIN_ThreadId());
+	Redun_Suppress = true;
+	Run_Num = 2;
+	bench_reset_budget(10, 1.0, 1);
+}
+
+// empties the log of the benchmark image and fills it with n traces
+static LogData* bench_fill_log(INT64 n)
+{
+	LogData* ldata = get_logdata(0, Bench_Img);
+	ldata->Log.clear();
+	ldata->Log.rehash(0);
+	ldata->Pending.clear();
+	ldata->Pending.shrink_to_fit();
+	ldata->Log.reserve(n);
+	for(INT64 i = 0; i < n; i++)
+	{
+		ldata->Log[(UINT64)i * 64] = 32;
+	}
+	return ldata;
+}
+
+/* ================================================================= */
+/* --------------------------- Benchmarks -------------------------- */
+static void StartEndTime(BenchState& state)
+{
+	Budget_Dec = (INT64)1 << 62;
+	while(state.KeepRunning())
+	{
+		dime_start_time();
+		dime_end_time();
+	}
+}
+DIME_BENCH(StartEndTime);
+
+// dime_scope with each probe policy (ScopeNone: the unbudgeted build)
+template <class Probe> static void bench_scope(BenchState& state)
+{
+	Budget_Dec = (INT64)1 << 62;
+	while(state.KeepRunning())
+	{
+		dime_scope<Probe> scope;
+	}
+}
+static void ScopeRdtsc(BenchState& state) { bench_scope<ProbeRdtsc>(state); }
+static void ScopeRdtscp(BenchState& state) { bench_scope<ProbeRdtscp>(state); }
+static void ScopeNone(BenchState& state) { bench_scope<ProbeNone>(state); }
+DIME_BENCH(ScopeRdtsc);
+DIME_BENCH(ScopeRdtscp);
+DIME_BENCH(ScopeNone);
+
+static volatile int Sink;
+static void HasBudget(BenchState& state)
+{
+	Budget_Dec = (INT64)1 << 62;
+	THREADID tid = PIN_ThreadId();
+	while(state.KeepRunning())
+	{
+		Sink = dime_has_budget(tid);
+	}
+}
+DIME_BENCH(HasBudget);
+
+static void HasBudgetEmpty(BenchState& state)
+{
+	Budget_Dec = 0;
+	THREADID tid = PIN_ThreadId();
+	while(state.KeepRunning())
+	{
+		Sink = dime_has_budget(tid);
+	}
+	Budget_Dec = Slot_Budget;
+}
+DIME_BENCH(HasBudgetEmpty);
+
+static void HasBudgetThread(BenchState& state)
+{
+	Steal_Enabled = true;
+	THREADID tid = PIN_ThreadId();
+	dime_slice_start(tid);
+	dime_slices_grant((INT64)1 << 62, false);
+	while(state.KeepRunning())
+	{
+		Sink = dime_has_budget_thread(tid);
+	}
+	Steal_Enabled = false;
+}
+DIME_BENCH(HasBudgetThread);
+
+// 1 lookup out of 2 hits the log
+static void CompareToLog(BenchState& state)
+{
+	bench_fill_log(state.Arg);
+	UINT64 key = 0;
+	UINT64 range = (UINT64)state.Arg * 2 * 64;
+	while(state.KeepRunning())
+	{
+		Sink = dime_compare_to_log(0, key, 32, Bench_Img);
+		key += 64 * 7919;//prime stride: scattered lookups
+		if(key >= range) key -= range;
+	}
+}
+DIME_BENCH_RANGE(CompareToLog, 1000, 10000000);
+
+// records instrumented traces already in the log, and erases one out of 4 right after
+static void ModifyLog(BenchState& state)
+{
+	LogData* ldata = bench_fill_log(state.Arg);
+	UINT64 key = 0;
+	UINT64 range = (UINT64)state.Arg * 64;
+	UINT64 n = 0;
+	while(state.KeepRunning())
+	{
+		dime_modify_log(VERSION_INSTRUMENT, 0, key, 32, Bench_Img);
+		if((++n & 3) == 0)
+		{
+			dime_modify_log(VERSION_BASE, 0, key, 32, Bench_Img);
+		}
+		key += 64 * 7919;
+		if(key >= range) key -= range;
+		if(ldata->Pending.size() >= (1 << 20))//the checkpointer would have written them
+		{
+			state.PauseTiming();
+			ldata->Pending.clear();
+			state.ResumeTiming();
+		}
+	}
+}
+DIME_BENCH_RANGE(ModifyLog, 1000, 10000000);
+
+// one iteration parses a whole log file of Arg lines
+static void ReadLog(BenchState& state)
+{
+	char file[] = "/tmp/dime_bench_log_XXXXXX";
+	int fd = mkstemp(file);
+	if(fd < 0)
+	{
+		perror("mkstemp");
+		exit(1);
+	}
+	string data = get_log_header() + "\n";
+	for(INT64 i = 0; i < state.Arg; i++)
+	{
+		data += decstr((UINT64)i * 64) + " 32\n";
+		if((i & 15) == 15) data += "- " + decstr((UINT64)(i - 3) * 64) + "\n";
+	}
+	if(write(fd, data.data(), data.size()) != (ssize_t)data.size()) perror("write");
+	close(fd);
+	bench_fill_log(0);
+	while(state.KeepRunning())
+	{
+		read_log(file, 0, Bench_Img);
+		state.PauseTiming();
+		bench_fill_log(0);
+		state.ResumeTiming();
+	}
+	state.Bytes = data.size() * state.Iterations;
+	unlink(file);
+}
+DIME_BENCH_RANGE(ReadLog, 1000, 10000000);
+
+static void PeriodReset(BenchState& state)
+{
+	bench_reset_budget(10, 1.0, 1);
+	while(state.KeepRunning())
+	{
+		handler_reset(SIGVTALRM);
+	}
+	Counter = 0;
+}
+DIME_BENCH(PeriodReset);
+
+static void PeriodResetPaced(BenchState& state)
+{
+	bench_reset_budget(10, 1.0, 16);
+	while(state.KeepRunning())
+	{
+		handler_reset(SIGVTALRM);
+	}
+	Counter = 0;
+	bench_reset_budget(10, 1.0, 1);
+}
+DIME_BENCH(PeriodResetPaced);
+
+/* ================================================================= */
+/* ------------------------- Period reset -------------------------- */
+static int Failed_Checks = 0;
+#define BENCH_CHECK(cond) \
+	do { if(!(cond)) { printf("CHECK FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); Failed_Checks++; } } while(0)
+
+// checks the budget refill of the alarm handler, with and without pacing
+static void check_period_reset()
+{
+	//without pacing: the whole budget at each period, overshoot forgotten
+	bench_reset_budget(10, 1.0, 1);
+	BENCH_CHECK(Budget == 100000000);
+	INT32 counter = Counter;
+	Budget_Dec = -5000;
+	handler_reset(SIGVTALRM);
+	BENCH_CHECK(Budget_Dec == Budget);
+	BENCH_CHECK(Counter == counter + 1);
+	BENCH_CHECK(Budget_Array[counter] == -5000);
+	//paused: no budget
+	Paused = true;
+	handler_reset(SIGVTALRM);
+	BENCH_CHECK(Budget_Dec == 0);
+	Paused = false;
+	//pacing: 4 slots, 3 slot ticks then a period boundary
+	bench_reset_budget(10, 1.0, 4);
+	BENCH_CHECK(Slot_Budget == Budget / 4);
+	BENCH_CHECK(Interval.it_value.tv_usec == 250000);
+	counter = Counter;
+	Budget_Dec = 0;//slot 0 used up
+	handler_reset(SIGVTALRM);
+	BENCH_CHECK(Budget_Dec == Slot_Budget);
+	handler_reset(SIGVTALRM);//slot 1 unused: carried
+	BENCH_CHECK(Budget_Dec == 2 * Slot_Budget);
+	handler_reset(SIGVTALRM);//carry is limited to one slot
+	BENCH_CHECK(Budget_Dec == 2 * Slot_Budget);
+	BENCH_CHECK(Counter == counter);
+	handler_reset(SIGVTALRM);//period boundary: no carry
+	BENCH_CHECK(Counter == counter + 1);
+	BENCH_CHECK(Budget_Dec == Slot_Budget);
+	bench_reset_budget(10, 1.0, 1);
+	Counter = 0;
+}
+
+/* ----------------------------------------------------------------- */
+int main(int argc, char** argv)
+{
+	const char* filter = "";
+	for(int i = 1; i + 1 < argc; i += 2)
+	{
+		if(strcmp(argv[i], "-filter") == 0) filter = argv[i + 1];
+		else if(strcmp(argv[i], "-max_entries") == 0) Max_Entries = atoll(argv[i + 1]);
+		else if(strcmp(argv[i], "-min_time") == 0) Min_Time = atof(argv[i + 1]);
+		else
+		{
+			fprintf(stderr, "usage: %s [-filter <substring>] [-max_entries <N>] [-min_time <sec>]\n", argv[0]);
+			return 1;
+		}
+	}
+	bench_init();
+	check_period_reset();
+	printf("%-28s %15s %14s\n", "Benchmark", "Time", "Iterations");
+	for(size_t i = 0; i < benches().size(); i++)
+	{
+		const Bench& b = benches()[i];
+		if(strstr(b.Name, filter) == NULL) continue;
+		if(b.Args.empty())
+		{
+			run_bench(b, 0);
+		}
+		for(size_t a = 0; a < b.Args.size() && b.Args[a] <= Max_Entries; a++)
+		{
+			run_bench(b, b.Args[a]);
+		}
+	}
+	return (Failed_Checks > 0) ? 1 : 0;
+}
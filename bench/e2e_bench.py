@@ -0,0 +1,241 @@
+#!/usr/bin/env python3
+"""
+End-to-end overhead-vs-coverage benchmark of the DIME tools.
+
+Runs each workload of bench/workloads natively, under Pin without a tool, under the
+full-instrumentation tool (call, branch) and under its DIME version (call_dime,
+branch_dime) for every combination of -b, -p and -r, then reports:
+  - wall-clock slowdown versus the native run and versus Pin without a tool
+  - achieved overhead (versus Pin without a tool) against the target budget -b
+  - budget used per period and overshoot percentiles, from pintool.log (Budget_Array)
+  - the instrumentation time of the most expensive stretch, p99, from pintool.log (#stretch)
+  - trace coverage versus the full run: recorded events, and distinct records
+    (call edges, branch sites); with -r, also cumulated over the runs 1..r
+  - the latency percentiles printed by the bursty workload
+Results are written to <out>/results.json and <out>/results.csv, one row per DIME run.
+
+Usage: e2e_bench.py --pin <pin> --tools <dir with call.so, call_dime.so, branch.so, branch_dime.so>
+                    [-b 5,10,20] [-p 1.0] [-r 0,3] [--workloads calls,branches,threads,bursty]
+                    [--tools-pairs call,branch] [--reps 3] [--scale 1] [--extra "-pace 8"] [--out e2e_out]
+    e.g. e2e_bench.py --pin ~/pin/pin --tools ../analysis_tools/obj-intel64 -b 5,10 -r 0,3
+-r 0 runs once without redundancy suppression; -r R runs 1..R in the same directory,
+so that each run reads the logs of the previous ones. --reps repeats the timed runs
+(native, Pin, full, and DIME with -r 0) and keeps the median time.
+"""
+
+import argparse
+import csv
+import json
+import os
+import re
+import shlex
+import statistics
+import subprocess
+import sys
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+WORKLOADS = ["calls", "branches", "threads", "bursty"]
+# full tool, DIME tool, output file of each
+TOOLS = {
+    "call": ("call", "call.out", "call_dime", "call_dime.out"),
+    "branch": ("branch", "branch.out", "branch_dime", "branch_dime.out"),
+}
+
+
+def csv_list(text, kind):
+    return [kind(x) for x in text.split(",") if x != ""]
+
+
+def run_timed(cmd, cwd):
+    """Runs cmd in cwd, returns (seconds, stdout)."""
+    start = time.monotonic()
+    proc = subprocess.run(cmd, cwd=cwd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+    seconds = time.monotonic() - start
+    if proc.returncode != 0:
+        sys.stderr.write("failed (%d): %s\n%s" % (proc.returncode, " ".join(cmd), proc.stderr))
+    return seconds, proc.stdout
+
+
+def median_run(cmd, cwd, reps):
+    runs = [run_timed(cmd, cwd) for _ in range(reps)]
+    return statistics.median(r[0] for r in runs), runs[-1][1]
+
+
+def percentile(values, q):
+    if not values:
+        return None
+    values = sorted(values)
+    return values[min(len(values) - 1, int(round(q / 100.0 * (len(values) - 1))))]
+
+
+def read_records(path):
+    """Returns the records of a tool output (one per line, without the final '# eof')."""
+    records = []
+    if not os.path.exists(path):
+        return records
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.rstrip("\n")
+            if line.startswith("# eof") or line == "":
+                continue
+            records.append(line)
+    return records
+
+
+def read_pintool_log(path, period_s):
+    """Budget_Array and stretch statistics of a DIME run (see dime_fini)."""
+    stats = {"periods": 0}
+    if not os.path.exists(path):
+        return stats
+    with open(path, errors="replace") as f:
+        lines = f.read().splitlines()
+    budget = None
+    left = []
+    for i, line in enumerate(lines):
+        m = re.match(r"#begin \(BUDGET = (\d+)ns\)", line)
+        if m:
+            budget = int(m.group(1))
+            for value in lines[i + 1:]:
+                if value.startswith("#eof"):
+                    break
+                if re.match(r"^-?\d+$", value):
+                    left.append(int(value))
+            break
+    for line in lines:
+        m = re.match(r"#stretch p50 = (\d+) p99 = (\d+) max = (\d+) usec", line)
+        if m:
+            stats["stretch_p50_us"], stats["stretch_p99_us"], stats["stretch_max_us"] = map(int, m.groups())
+    if budget is None or not left:
+        return stats
+    # the last value is the partial period closed at exit
+    full = left[:-1] if len(left) > 1 else left
+    period_ns = period_s * 1e9
+    used = [(budget - l) / period_ns * 100.0 for l in full]
+    overshoot = [max(0, -l) / budget * 100.0 if budget > 0 else 0.0 for l in full]
+    stats.update({
+        "periods": len(full),
+        "budget_ns": budget,
+        "budget_used_pct": statistics.mean(used),
+        "overshoot_p50_pct": percentile(overshoot, 50),
+        "overshoot_p90_pct": percentile(overshoot, 90),
+        "overshoot_p99_pct": percentile(overshoot, 99),
+        "overshoot_max_pct": max(overshoot),
+        "overshoot_periods": sum(1 for o in overshoot if o > 0),
+    })
+    return stats
+
+
+def app_latency(stdout):
+    """Latency percentiles printed by the bursty workload, if any."""
+    out = {}
+    for key in ("p50_us", "p99_us", "max_us"):
+        m = re.search(key + r" (\d+)", stdout)
+        if m:
+            out["app_" + key] = int(m.group(1))
+    return out
+
+
+def build_workload(name, cc, bin_dir):
+    src = os.path.join(HERE, "workloads", name + ".c")
+    exe = os.path.join(bin_dir, name)
+    # -O1: keep the calls and branches that the workloads are made of
+    subprocess.check_call([cc, "-O1", "-pthread", "-o", exe, src])
+    return exe
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--pin", required=True, help="pin launcher")
+    ap.add_argument("--tools", required=True, help="directory of the compiled tools (.so)")
+    ap.add_argument("-b", default="5,10,20", help="budget percentages")
+    ap.add_argument("-p", default="1.0", help="periods in seconds")
+    ap.add_argument("-r", default="0", help="redundancy suppression: 0 or the number of runs")
+    ap.add_argument("--workloads", default=",".join(WORKLOADS))
+    ap.add_argument("--tools-pairs", default=",".join(TOOLS), help="tool pairs: call, branch")
+    ap.add_argument("--reps", type=int, default=3)
+    ap.add_argument("--scale", default="1", help="workload argument")
+    ap.add_argument("--extra", default="", help="more options of the DIME tools, e.g. \"-pace 8\"")
+    ap.add_argument("--cc", default="cc")
+    ap.add_argument("--out", default="e2e_out")
+    args = ap.parse_args()
+
+    out = os.path.abspath(args.out)
+    bin_dir = os.path.join(out, "bin")
+    os.makedirs(bin_dir, exist_ok=True)
+    pin = os.path.abspath(os.path.expanduser(args.pin))
+    tools = os.path.abspath(os.path.expanduser(args.tools))
+    extra = shlex.split(args.extra)
+    rows = []
+    for workload in csv_list(args.workloads, str):
+        exe = build_workload(workload, args.cc, bin_dir)
+        app = [exe, args.scale]
+        base_dir = os.path.join(out, "runs", workload)
+        os.makedirs(base_dir, exist_ok=True)
+        native_s, _ = median_run(app, base_dir, args.reps)
+        pin_s, _ = median_run([pin, "--"] + app, base_dir, args.reps)
+        print("%s: native %.3fs, pin %.3fs" % (workload, native_s, pin_s))
+        for pair in csv_list(args.tools_pairs, str):
+            full_tool, full_out, dime_tool, dime_out = TOOLS[pair]
+            full_dir = os.path.join(base_dir, full_tool)
+            os.makedirs(full_dir, exist_ok=True)
+            full_cmd = [pin, "-t", os.path.join(tools, full_tool + ".so"), "--"] + app
+            full_s, _ = median_run(full_cmd, full_dir, args.reps)
+            full_records = read_records(os.path.join(full_dir, full_out))
+            full_distinct = set(full_records)
+            print("  %s: %.3fs, %d records" % (full_tool, full_s, len(full_records)))
+            for b in csv_list(args.b, float):
+                for p in csv_list(args.p, float):
+                    for r in csv_list(args.r, int):
+                        run_dir = os.path.join(base_dir, dime_tool, "b%g_p%g_r%d" % (b, p, r))
+                        os.makedirs(run_dir, exist_ok=True)
+                        for name in os.listdir(run_dir):  # fresh logs for -r
+                            os.remove(os.path.join(run_dir, name))
+                        seen = set()
+                        for run in (range(1, r + 1) if r > 0 else [0]):
+                            cmd = [pin, "-t", os.path.join(tools, dime_tool + ".so"),
+                                   "-b", str(b), "-p", str(p), "-r", str(run)] + extra + ["--"] + app
+                            dime_s, stdout = median_run(cmd, run_dir, args.reps if r == 0 else 1)
+                            records = read_records(os.path.join(run_dir, dime_out))
+                            distinct = set(records)
+                            seen |= distinct
+                            overhead = (dime_s - pin_s) / pin_s * 100.0 if pin_s > 0 else None
+                            row = {
+                                "workload": workload, "tool": dime_tool, "b": b, "p": p, "r": r, "run": run,
+                                "extra": args.extra, "time_s": dime_s, "native_s": native_s, "pin_s": pin_s,
+                                "full_s": full_s,
+                                "slowdown_native": dime_s / native_s if native_s > 0 else None,
+                                "slowdown_pin": dime_s / pin_s if pin_s > 0 else None,
+                                "full_slowdown_native": full_s / native_s if native_s > 0 else None,
+                                "target_pct": b, "overhead_pct": overhead,
+                                "overhead_vs_target": overhead / b if overhead is not None and b > 0 else None,
+                                "events": len(records), "full_events": len(full_records),
+                                "event_coverage": len(records) / len(full_records) if full_records else None,
+                                "distinct": len(distinct), "full_distinct": len(full_distinct),
+                                "distinct_coverage": len(distinct & full_distinct) / len(full_distinct) if full_distinct else None,
+                                "cumulative_coverage": len(seen & full_distinct) / len(full_distinct) if full_distinct else None,
+                            }
+                            row.update(read_pintool_log(os.path.join(run_dir, "pintool.log"), p))
+                            row.update(app_latency(stdout))
+                            rows.append(row)
+                            print("    -b %g -p %g -r %d: %.3fs, overhead %s%% (target %g%%), coverage %s" % (
+                                b, p, run, dime_s,
+                                "%.1f" % overhead if overhead is not None else "?", b,
+                                "%.3f" % row["distinct_coverage"] if row["distinct_coverage"] is not None else "?"))
+    with open(os.path.join(out, "results.json"), "w") as f:
+        json.dump(rows, f, indent=1)
+    columns = []
+    for row in rows:
+        for key in row:
+            if key not in columns:
+                columns.append(key)
+    with open(os.path.join(out, "results.csv"), "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=columns)
+        writer.writeheader()
+        writer.writerows(rows)
+    print("%d runs written to %s/results.json and results.csv" % (len(rows), out))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
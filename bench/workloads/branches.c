@@ -0,0 +1,41 @@
+/*
+	Branch-heavy workload: data-dependent conditional branches with
+	predictable and unpredictable patterns, and a small switch.
+	Usage: branches [scale]   (default scale 1: short natively, seconds under full instrumentation)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N 4096
+
+int main(int argc, char** argv)
+{
+	long scale = (argc > 1) ? atol(argv[1]) : 1;
+	static unsigned data[N];
+	unsigned seed = 12345;
+	for(int i = 0; i < N; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed >> 8;
+	}
+	long sum = 0;
+	for(long r = 0; r < scale * 1000; r++)
+	{
+		for(int i = 0; i < N; i++)
+		{
+			unsigned v = data[i];
+			if(v & 1) sum += v;//unpredictable
+			else sum -= i;
+			if(i & 8) sum ^= 3;//predictable pattern
+			switch(v & 3)
+			{
+				case 0: sum += 1; break;
+				case 1: sum -= 2; break;
+				case 2: sum ^= 5; break;
+				default: sum += r; break;
+			}
+		}
+	}
+	printf("branches %ld\n", sum);
+	return 0;
+}
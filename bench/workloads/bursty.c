@@ -0,0 +1,50 @@
+/*
+	Bursty workload: short bursts of calls separated by idle gaps, like a server
+	handling requests. Prints the latency percentiles of the bursts, so that the
+	effect of the instrumentation (e.g. -pace) on the tail latency can be compared.
+	Usage: bursty [scale]   (default scale 1: 400 bursts)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+__attribute__((noinline)) static long handle(long x)
+{
+	long s = 0;
+	for(long i = 0; i < 200; i++) s += (x + i) % 7 ? i : -i;
+	return s;
+}
+
+static long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int cmp_long(const void* a, const void* b)
+{
+	long x = *(const long*)a, y = *(const long*)b;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv)
+{
+	long scale = (argc > 1) ? atol(argv[1]) : 1;
+	long n = 400 * scale;
+	long* lat = malloc(n * sizeof(long));
+	long sum = 0;
+	for(long b = 0; b < n; b++)
+	{
+		long start = now_ns();
+		for(long r = 0; r < 2000; r++) sum += handle(r + b);//one request
+		lat[b] = now_ns() - start;
+		struct timespec gap = { 0, 1000000 };//1 ms idle
+		nanosleep(&gap, NULL);
+	}
+	qsort(lat, n, sizeof(long), cmp_long);
+	printf("bursty %ld p50_us %ld p99_us %ld max_us %ld\n", sum,
+	       lat[n / 2] / 1000, lat[(n - 1) * 99 / 100] / 1000, lat[n - 1] / 1000);
+	free(lat);
+	return 0;
+}
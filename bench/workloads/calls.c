@@ -0,0 +1,37 @@
+/*
+	Call-heavy workload: a deep and wide call graph of small functions,
+	with direct calls, calls through a function pointer table, and recursion.
+	Usage: calls [scale]   (default scale 1: short natively, seconds under full instrumentation)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef long (*op_t)(long);
+
+__attribute__((noinline)) static long op_add(long x) { return x + 7; }
+__attribute__((noinline)) static long op_mul(long x) { return x * 3; }
+__attribute__((noinline)) static long op_xor(long x) { return x ^ 0x5a5a; }
+__attribute__((noinline)) static long op_shift(long x) { return (x << 1) | (x >> 63 & 1); }
+
+static op_t Ops[4] = { op_add, op_mul, op_xor, op_shift };
+
+__attribute__((noinline)) static long leaf(long x) { return Ops[x & 3](x); }
+__attribute__((noinline)) static long inner(long x) { return leaf(x) + leaf(x + 1); }
+__attribute__((noinline)) static long outer(long x) { return inner(x) - inner(x >> 1); }
+__attribute__((noinline)) static long fib(long n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }
+
+int main(int argc, char** argv)
+{
+	long scale = (argc > 1) ? atol(argv[1]) : 1;
+	long sum = 0;
+	for(long r = 0; r < scale; r++)
+	{
+		for(long i = 0; i < 1000000; i++)
+		{
+			sum += outer(i + sum);
+		}
+		sum += fib(24);
+	}
+	printf("calls %ld\n", sum);
+	return 0;
+}
@@ -0,0 +1,62 @@
+/*
+	Multithreaded workload: worker threads mixing calls and branches, one of them
+	mostly blocked (sleeping), so that threads use the budget unevenly.
+	Usage: threads [scale] [threads]   (default scale 1, 4 threads)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+static long Scale = 1;
+
+__attribute__((noinline)) static long step(long x)
+{
+	if(x & 1) return x * 3 + 1;
+	return x >> 1;
+}
+
+__attribute__((noinline)) static long chain(long x)
+{
+	long n = 0;
+	while(x > 1 && n < 64)
+	{
+		x = step(x);
+		n++;
+	}
+	return n;
+}
+
+static void* worker(void* arg)
+{
+	long id = (long)arg;
+	long sum = 0;
+	for(long i = 1; i < Scale * 150000; i++)
+	{
+		sum += chain(i * (id + 1));
+		if(id == 0 && (i & 0xffff) == 0)
+		{
+			struct timespec ts = { 0, 2000000 };//the I/O-bound thread
+			nanosleep(&ts, NULL);
+		}
+	}
+	return (void*)sum;
+}
+
+int main(int argc, char** argv)
+{
+	Scale = (argc > 1) ? atol(argv[1]) : 1;
+	int n = (argc > 2) ? atoi(argv[2]) : 4;
+	pthread_t threads[64];
+	if(n > 64) n = 64;
+	for(long t = 0; t < n; t++) pthread_create(&threads[t], NULL, worker, (void*)t);
+	long sum = 0;
+	for(int t = 0; t < n; t++)
+	{
+		void* r;
+		pthread_join(threads[t], &r);
+		sum += (long)r;
+	}
+	printf("threads %ld\n", sum);
+	return 0;
+}
@@ -0,0 +1,268 @@
+/*
+	DIME backend for compiler instrumentation (gcc/clang -finstrument-functions).
+	The compiler inserts a call to __cyg_profile_func_enter/exit at the entry and exit of
+	every function of the program; this library implements them with DIME's budget: the
+	hooks do nothing while no budget is left, so the program runs at near-native speed
+	outside the instrumented part of each period. No Pin is needed.
+
+	It reuses dime_core.h (stub backend of dime_platform.h): same budget, period, pacing,
+	sampling statistics and redundancy logs as the Pin tools. The output has the format of
+	call_dime.cpp: "C caller callee" at each call and "R function" at each return.
+	With redundancy suppression, the log keys are the image-relative function addresses:
+	a function recorded by a previous run is not traced again.
+
+	To compile:  g++ -O2 -std=c++11 -shared -fPIC -pthread -I.. -o libdime_cyg.so dime_cyg.cpp -ldl -lrt
+	To use:      gcc -finstrument-functions -rdynamic -o app app.c
+	             LD_PRELOAD=./libdime_cyg.so DIME_BUDGET=10 DIME_PERIOD=1.0 ./app
+	             (-rdynamic exports the function names of the executable for dladdr;
+	             without it, functions of the executable are written as "invalid")
+	Environment:
+	             DIME_BUDGET   budget percentage (default 10)
+	             DIME_PERIOD   time period in seconds (default 1.0)
+	             DIME_PACE     slots per period, see -pace (default 1)
+	             DIME_RUN      run number for redundancy suppression, 0: disabled (default 0)
+	             DIME_OUT      output file (default dime_cyg.out)
+	Statistics (budget left per period, sampling, stretches) go to dime_cyg.log, like
+	pintool.log. The redundancy logs are written at exit (log_<thread>_<image>.out).
+*/
+
+#define DIME_PLATFORM_STUB
+#include "dime_core.h"
+
+#include <stdarg.h>
+#include <dlfcn.h>
+#include <stdlib.h>
+
+#define DIME_CYG_NO_HOOK __attribute__((no_instrument_function))
+
+// function seen by a thread: resolved once with dladdr
+struct CygFunction
+{
+	string Name;
+	char* Img;//interned image name (key of Img_Logs)
+	UINT64 Rel_Addr;//address relative to the image base
+	BOOL Redundant;//in the log of a previous run: not traced
+	BOOL Logged;//recorded in the log by this run
+};
+
+class CygThread
+{
+  public:
+	std::unordered_map<ADDRINT, CygFunction> Functions;
+	std::unordered_map<char*, BOOL> Logs_Read;//images whose log file was read by this thread
+};
+
+static FILE* Cyg_File = NULL;
+static BOOL Cyg_Ready = false;//hooks are active between the constructor and the destructor
+static std::unordered_map<string, char*> Img_Names;//image path -> interned name, under Lock
+static CygThread* Cyg_Threads[PIN_MAX_THREADS];//by thread id: kept for the next thread with the same id
+static __thread BOOL In_Hook = false;//the hooks are not reentrant (e.g. alarm during a hook)
+
+/* ----------------------------------------------------------------- */
+static DIME_CYG_NO_HOOK float env_float(const char* name, float def)
+{
+	const char* v = getenv(name);
+	return (v != NULL && *v != '\0') ? atof(v) : def;
+}
+/* ----------------------------------------------------------------- */
+// the same pointer for the same image in all threads (Img_Logs is keyed by pointer)
+static DIME_CYG_NO_HOOK char* cyg_intern_img(const char* path, THREADID thread_id)
+{
+	GetLock(&Lock, thread_id+1);
+	char*& name = Img_Names[path];
+	if(name == NULL) name = strdup(path);
+	ReleaseLock(&Lock);
+	return name;
+}
+/* ----------------------------------------------------------------- */
+// first hook of a thread id: thread data, as dime_thread_start() does for the Pin tools.
+// A thread that exits gives its id to the next new thread (dime_platform.h), which goes on
+// with the same data: the memory stays bounded by the threads running at once, and the
+// redundancy log of the id (log_<id>_<image>.out) keeps growing like with Pin thread ids
+static DIME_CYG_NO_HOOK CygThread* cyg_thread(THREADID thread_id)
+{
+	if(Cyg_Threads[thread_id] == NULL)
+	{
+		Cyg_Threads[thread_id] = new CygThread;
+		PIN_SetThreadData(Tls_Key, new ThreadData, thread_id);
+		GetLock(&Lock, thread_id+1);
+		if((INT32)thread_id >= Num_Threads) Num_Threads = thread_id + 1;
+		ReleaseLock(&Lock);
+	}
+	return Cyg_Threads[thread_id];
+}
+/* ----------------------------------------------------------------- */
+// looks up fn in the cache of the thread, resolves it on the first call
+static DIME_CYG_NO_HOOK CygFunction* cyg_function(THREADID thread_id, void* fn)
+{
+	CygThread* thread = cyg_thread(thread_id);
+	auto it = thread->Functions.find((ADDRINT)fn);
+	if(it != thread->Functions.end()) return &it->second;
+	CygFunction& f = thread->Functions[(ADDRINT)fn];
+	Dl_info info;
+	if(dladdr(fn, &info) != 0)
+	{
+		f.Name = (info.dli_sname != NULL) ? info.dli_sname : "invalid";
+		f.Img = cyg_intern_img(info.dli_fname, thread_id);
+		f.Rel_Addr = (ADDRINT)fn - (ADDRINT)info.dli_fbase;
+	}
+	else
+	{
+		f.Name = "invalid";
+		f.Img = cyg_intern_img("unknown", thread_id);
+		f.Rel_Addr = (ADDRINT)fn;
+	}
+	f.Logged = false;
+	f.Redundant = false;
+	if(Redun_Suppress)
+	{
+		if(Run_Num > 1 && !thread->Logs_Read[f.Img])
+		{
+			//first function of this image in this thread, as ImageLoad() for the Pin tools
+			thread->Logs_Read[f.Img] = true;
+			read_log(get_log_file_name(thread_id, f.Img), thread_id, f.Img);
+		}
+		f.Redundant = !dime_compare_to_log(thread_id, f.Rel_Addr, 1, f.Img);
+	}
+	return &f;
+}
+/* ----------------------------------------------------------------- */
+// name of the function that contains a call site
+static DIME_CYG_NO_HOOK const char* cyg_caller_name(void* call_site)
+{
+	Dl_info info;
+	return (dladdr(call_site, &info) != 0 && info.dli_sname != NULL) ? info.dli_sname : "invalid";
+}
+/* ----------------------------------------------------------------- */
+// records a traced function in the redundancy log (VERSION_INSTRUMENT: it was instrumented)
+static DIME_CYG_NO_HOOK void cyg_log_function(THREADID thread_id, CygFunction* f)
+{
+	if(Redun_Suppress && !f->Logged)
+	{
+		f->Logged = true;
+		dime_modify_log(VERSION_INSTRUMENT, thread_id, f->Rel_Addr, 1, f->Img);
+	}
+}
+
+/* ================================================================= */
+/* ----------------------------- Hooks ----------------------------- */
+// writes one line of the output; the destructor closes the output under the same lock,
+// so a thread still inside a hook writes nothing after it
+static DIME_CYG_NO_HOOK __attribute__((format(printf, 1, 2))) void cyg_printf(const char* format, ...)
+{
+	va_list args;
+	flockfile(Cyg_File);
+	if(Cyg_Ready)
+	{
+		va_start(args, format);
+		vfprintf(Cyg_File, format, args);
+		va_end(args);
+	}
+	funlockfile(Cyg_File);
+}
+extern "C" DIME_CYG_NO_HOOK void __cyg_profile_func_enter(void* fn, void* call_site)
+{
+	THREADID thread_id = PIN_ThreadId();
+	if(thread_id == INVALID_THREADID) return;//more than PIN_MAX_THREADS threads at once: not traced
+	if(!dime_has_budget(thread_id) || !Cyg_Ready || In_Hook) return;//the only cost without budget
+	In_Hook = true;
+	{
+		dime_scope<> scope;//per-call start stamp: the globals of dime_start_time() are shared by the threads
+		CygFunction* f = cyg_function(thread_id, fn);
+		if(!f->Redundant)
+		{
+			cyg_printf("C %s %s\n", cyg_caller_name(call_site), f->Name.c_str());
+			dime_count_event(thread_id);
+			cyg_log_function(thread_id, f);
+		}
+	}
+	In_Hook = false;
+}
+/* ----------------------------------------------------------------- */
+extern "C" DIME_CYG_NO_HOOK void __cyg_profile_func_exit(void* fn, void* call_site)
+{
+	THREADID thread_id = PIN_ThreadId();
+	if(thread_id == INVALID_THREADID) return;
+	if(!dime_has_budget(thread_id) || !Cyg_Ready || In_Hook) return;
+	In_Hook = true;
+	{
+		dime_scope<> scope;
+		CygFunction* f = cyg_function(thread_id, fn);
+		if(!f->Redundant)
+		{
+			cyg_printf("R %s\n", f->Name.c_str());
+			dime_count_event(thread_id);
+			cyg_log_function(thread_id, f);
+		}
+	}
+	In_Hook = false;
+}
+
+/* ================================================================= */
+/* ------------------------- Init and fini ------------------------- */
+// same steps as dime_init(), with the environment instead of the knobs
+static DIME_CYG_NO_HOOK __attribute__((constructor)) void dime_cyg_init()
+{
+	Stub_Log_File = fopen("dime_cyg.log", "w");
+	const char* out = getenv("DIME_OUT");
+	Cyg_File = fopen((out != NULL && *out != '\0') ? out : "dime_cyg.out", "w");
+	if(Cyg_File == NULL)
+	{
+		LOG("Dime initialization failed! Cannot open the output file\n");
+		return;
+	}
+	InitLock(&Lock);
+	InitLock(&Log_Lock);
+	InitLock(&Ckpt_Lock);
+	InitLock(&Site_Lock);
+	Tls_Key = PIN_CreateThreadDataKey(0);
+	float pace = env_float("DIME_PACE", 1);
+	Pace_Slots = (pace > 1) ? (UINT32)pace : 1;
+	dime_set_budget(env_float("DIME_BUDGET", 10), env_float("DIME_PERIOD", 1.0));
+	Budget_Dec = Slot_Budget;
+	Period_Start_Tsc = dime_rdtsc64();
+	dime_stretch_begin(Period_Start_Tsc);
+	Run_Num = (int)env_float("DIME_RUN", 0);
+	Redun_Suppress = (Run_Num > 0);
+	Alarm_Reset.sa_handler = handler_reset;
+	if(sigaction(SIGVTALRM, &Alarm_Reset, NULL) != 0 || setitimer(ITIMER_VIRTUAL, &Interval, NULL) != 0)
+	{
+		LOG("Dime initialization failed! ErrNo = " + decstr(errno) + "\n");
+		return;
+	}
+	Cyg_Ready = true;
+}
+/* ----------------------------------------------------------------- */
+// same report as dime_fini(), in dime_cyg.log
+static DIME_CYG_NO_HOOK __attribute__((destructor)) void dime_cyg_fini()
+{
+	if(!Cyg_Ready) return;
+	flockfile(Cyg_File);
+	Cyg_Ready = false;//the hooks stop writing
+	funlockfile(Cyg_File);
+	struct itimerval off;
+	memset(&off, 0, sizeof(off));
+	setitimer(ITIMER_VIRTUAL, &off, NULL);
+	LOG("#begin (BUDGET = " + decstr(Budget) +  "ns)\n");
+	dime_close_sampling();
+	for (int i = 0; i < Counter; i++){
+		LOG(decstr(Budget_Array[i]) + "\n");
+	}
+	LOG("#eof\n");
+	LOG("#sampling (checks active_checks events)\n");
+	for (int i = 0; i < Counter; i++){
+		LOG(decstr(Checks_Array[i]) + " " + decstr(Active_Array[i]) + " " + decstr(Events_Array[i]) + "\n");
+	}
+	LOG("#estimate recorded = " + decstr(Est_Recorded) + " total = " + fltstr(Est_Total, 0) +
+	    " +- " + fltstr(1.96 * Est_Rel_Err * Est_Total, 0) + " (95%) scale = " + fltstr(Est_Scale, 4) + "\n");
+	LOG("#eof\n");
+	dime_stretch_report();
+	if(Redun_Suppress)
+	{
+		dime_checkpoint();
+	}
+	fprintf(Cyg_File, "# eof");
+	fflush(Cyg_File);//not closed: other threads can still be inside a hook
+	if(Stub_Log_File != NULL) fclose(Stub_Log_File);
+	Stub_Log_File = NULL;
+}
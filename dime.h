@@ -12,148 +12,151 @@
 	1- In main() call dime_init()
 	2- In Fini() call dime_fini()
 	3- In the analysis routines call dime_start_time() at the beginning and dime_end_time() at the end
+	   (or declare a dime_scope<> at the beginning, see the Scoped probes section of dime_core.h;
+	   a multi-threaded tool must use dime_scope<>: the globals of dime_start_time() are shared)
 	4- In the instrumentation routine:
 		- call dime_switch_version(version, ins); followed by the switch case
 		
 	And to enable redundancy supression:
 	5- Call dime_thread_start() in the ThreadStart callback function
 	6- Before the loops in the instrumentation routine:
-		if(dime_compare_to_log())
+		if(dime_compare_to_log()) with the trace key dime_trace_key(trace, trace_rel_addr)
 	7- After the loop, but inside the condition in bullet 6:
 		dime_modify_log()
 		
+	And to skip duplicate events in the analysis routines:
+	- Call dime_thread_start() in the ThreadStart callback function
+	- In the analysis routine (between dime_start_time() and dime_end_time()):
+		if(dime_seen(thread_id, key)) -> skip formatting and output of the event
+		
+	And to extrapolate the sampled results to a full-instrumentation run:
+	- In the analysis routines call dime_count_event(thread_id) for each recorded event
+	- In Fini(), before dime_fini(): dime_estimate(observed_count) returns the
+	  estimated full-instrumentation count and its 95% confidence interval (see
+	  Statistical extrapolation in dime_core.h for its assumptions)
+		
+	The redundancy-suppression logs are checkpointed every -ckpt seconds by a Pin internal
+	thread (append-only deltas), so they survive a crash or a SIGKILL of the application.
+		
+	The budget and the period can be changed while the application runs, through the
+	control socket given by -ctl (see the Control channel section below).
+		
+	And to demote the sites that cost much more than the others (-demote):
+	- In the instrumentation routine: DimeSite* site = dime_site(INS_Address(ins)), passed with IARG_PTR
+	- In the analysis routine: if(dime_site_demoted(site)) run a cheaper version (or nothing)
+	  with dime_end_time(), else run the full version with dime_end_time_site(site)
+		
+	And to instrument only the code selected by the filters (-img_*, -sym_*, -range_*):
+	- In the instrumentation routine, before the loops: if(!dime_filter_trace(TRACE_Address(trace))) return;
+		
+	With -shared_budget 1, the processes forked by the application share one budget
+	(see the Shared budget pool section below).
+		
+	With -steal 1 or -r, DIME registers its own ThreadStart callback, so that every thread
+	gets a budget slice and a log; calling dime_thread_start() from the tool as well is harmless.
+		
+	And to write the tool output to one file per thread (no shared stdio lock):
+	- Call dime_thread_start() and then dime_shard_open(thread_id, base_name) in the
+	  ThreadStart callback function: the thread writes to base_name.<thread_id + 1>
+	- In the analysis routines: dime_shard_printf(thread_id, format, ...)
+	  writes one record, stamped with rdtsc, to the private buffer of the thread
+	- dime_fini() flushes and closes the shards; offline_tools/dime_merge.cpp
+	  merges them into one trace ordered by time stamp
+		
 	And include DIME's header file:
 	8- #include "dime.h"
+	
+	dime.h holds the Pin-specific part (knobs, version switch, filters, checkpointing, control
+	channel, init and fini); the budget engine, the probes and the logs are in dime_core.h.
 */
 
+#include "dime_core.h"
 
-#include <iostream>
-#include <fstream>
-#include <string>
-#include <sstream>
-#include <signal.h>
-#include <assert.h>
-#include <sys/time.h>
-#include <unordered_map>
-
-#define sec_to_nsec 1000000000//from second to nanosecond
-#define usec_to_nsec 1000//from microsecond to nanosecond
-#define Freq 3401 //grep 'cpu MHz' /proc/cpuinfo
-#define rdtsc(low,high) \
-     __asm__ __volatile__("rdtsc" : "=a" (low), "=d" (high))
-     
 // Knobs (command line arguments)
 KNOB<float> KnobBudgPercent(KNOB_MODE_WRITEONCE, "pintool", "b", "10", "Budget Percentage");
 KNOB<float> KnobPeriod(KNOB_MODE_WRITEONCE, "pintool", "p", "1.0", "Time Period in seconds (as float)");     
 KNOB<int> KnobRunNum(KNOB_MODE_WRITEONCE, "pintool", "r", "0", "Run Number (for redundancy suppression)");// 0: to disable (default)
+KNOB<string> KnobKeyMode(KNOB_MODE_WRITEONCE, "pintool", "key", "addr", "Key of the traces in the redundancy logs: addr (image-relative address) or hash (hash of the code)");
+KNOB<string> KnobControl(KNOB_MODE_WRITEONCE, "pintool", "ctl", "", "Path of a Unix-domain socket to change budget and period at run time (empty: disabled)");
+KNOB<string> KnobImgInclude(KNOB_MODE_APPEND, "pintool", "img_include", "", "Instrument only the images matching this glob (can be repeated)");
+KNOB<string> KnobImgExclude(KNOB_MODE_APPEND, "pintool", "img_exclude", "", "Do not instrument the images matching this glob (can be repeated)");
+KNOB<string> KnobSymInclude(KNOB_MODE_APPEND, "pintool", "sym_include", "", "Instrument only the routines with this name prefix (can be repeated)");
+KNOB<string> KnobSymExclude(KNOB_MODE_APPEND, "pintool", "sym_exclude", "", "Do not instrument the routines with this name prefix (can be repeated)");
+KNOB<string> KnobRangeInclude(KNOB_MODE_APPEND, "pintool", "range_include", "", "Instrument only the addresses in lo:hi (can be repeated)");
+KNOB<string> KnobRangeExclude(KNOB_MODE_APPEND, "pintool", "range_exclude", "", "Do not instrument the addresses in lo:hi (can be repeated)");
+KNOB<float> KnobDemote(KNOB_MODE_WRITEONCE, "pintool", "demote", "0", "Demote the sites whose cost is above this multiple of the median (0: disabled)");
+KNOB<int> KnobDemoteBackoff(KNOB_MODE_WRITEONCE, "pintool", "demote_backoff", "4", "Number of periods a demoted site stays demoted");
+KNOB<int> KnobPace(KNOB_MODE_WRITEONCE, "pintool", "pace", "1", "Number of slots of each period, each slot gets its share of the budget (1: whole budget at the period start)");
+KNOB<BOOL> KnobSteal(KNOB_MODE_WRITEONCE, "pintool", "steal", "0", "Split the budget into per-thread slices, threads that run dry steal from the others");
+KNOB<BOOL> KnobSharedBudget(KNOB_MODE_WRITEONCE, "pintool", "shared_budget", "0", "Share one budget between the processes of the fork tree");
+KNOB<float> KnobCheckpoint(KNOB_MODE_WRITEONCE, "pintool", "ckpt", "1.0", "Checkpoint period of the redundancy logs in seconds (0: write at exit only)");
 
-struct sigaction Alarm_Reset;//alarm to reset the budget using signal.h
-struct itimerval Interval;//used by setitimer()
-static FILE* Trace_File;//for the tool output
-static ofstream Trace_File2;//for the overshoots
-static UINT32 Budget;//in nanoseconds
-static INT64 Budget_Dec;//variable to decrement, in nanoseconds
-static const INT32 MAX_SIZE = 86400;//enough to write a string of 11 char's every second for a full day
-static INT64 Budget_Array[MAX_SIZE];
-static INT32 Counter = 0;
-UINT32 Low_S, Low_E;//used by rdtsc()
-UINT32 High_S, High_E;//used by rdtsc()
 static REG Version_Reg;//used by INS_InsertVersionCase()
-static BOOL Alarm_Fired = true;//for TVC
-enum 
-{
-    VERSION_BASE,
-    VERSION_INSTRUMENT
-};
+static PIN_THREAD_UID Ckpt_Thread_Uid;
+static volatile BOOL Ckpt_Stop = false;
+static BOOL Ckpt_Thread_Started = false;
+//control channel (-ctl)
+static PIN_THREAD_UID Ctl_Thread_Uid;
+static volatile BOOL Ctl_Stop = false;
+static BOOL Ctl_Thread_Started = false;
 
-//the log is a hashtable (unordered_map)
-int Run_Num = 1;//DIME run
-BOOL Redun_Suppress = false;//flag if redundancy suppression feature is used
-static TLS_KEY Tls_Key;
-PIN_LOCK Lock;
-INT32 Num_Threads = 0;
+static VOID dime_checkpoint_thread(VOID* arg);
+//forks
+static volatile UINT32 Fork_Count = 0;//children forked by this process
+static UINT32 Fork_Num[PIN_MAX_THREADS];//number of the child being forked by each thread
 
-class LogData
-{
-  public:
-    LogData() : Previous_Trace(0), Previous_Size(0), Total_Test(0), Errors("") {}
-    std::unordered_map<UINT64,USIZE> Log;//trace relative address, trace size: only for the instrumented traces
-    UINT64 Previous_Trace;//relative address of previous trace whose version = 1
-    USIZE Previous_Size;//size of previous trace whose version = 1
-    int Total_Test;//total number of traces compared to Log
-    string Errors;
-    FILE* Trace_File;//use it if you need a Trace_File for each thread to avoid racing
-};
-
-class ThreadData
-{
-    public:
-	ThreadData(void) {}
-	std::unordered_map<char*,LogData> Img_Logs; //<img_name, LogData>: each image in the thread has its own log data
-};
 /* ----------------------------------------------------------------- */
-// function to access Log data of specific image in a specific thread
-LogData* get_logdata(THREADID thread_id, char* img_name)
-{
-    ThreadData* tdata = 
-          static_cast<ThreadData*>(PIN_GetThreadData(Tls_Key, thread_id));
-    if(tdata->Img_Logs.find(img_name) == tdata->Img_Logs.end())//if img_name not found
-    { 
-	tdata->Img_Logs.insert(std::pair<char*, LogData>((char*)img_name,  LogData()));
-    }
-    return &(tdata->Img_Logs[img_name]);// returns log data of image 
+// fork callback, in the parent before the fork: numbers the child
+static VOID dime_fork_before(THREADID thread_id, const CONTEXT* ctxt, VOID* v)
+{
+	Fork_Num[thread_id] = __sync_add_and_fetch(&Fork_Count, 1);
 }
-
-// function to access thread-specific data
-ThreadData* get_tls(THREADID thread_id)
+/* ----------------------------------------------------------------- */
+// exec under Pin (-follow_execv): the new image keeps the pid and registers again,
+// so this image frees its slot of the budget pool
+static BOOL dime_exec_child(CHILD_PROCESS child, VOID* v)
 {
-    ThreadData* tdata = 
-          static_cast<ThreadData*>(PIN_GetThreadData(Tls_Key, thread_id));
-    return tdata;
+	dime_pool_leave();
+	return TRUE;//Pin follows the exec'd image
 }
 /* ----------------------------------------------------------------- */
-int read_log(string file, THREADID thread_id, char* img_name)
+// fork callback, in the child: joins the pool and restarts what fork() does not copy
+static VOID dime_fork_child(THREADID thread_id, const CONTEXT* ctxt, VOID* v)
 {
-	string line;
-	ifstream myfile(file);
-	int ret = 0;
-	UINT64 tr;
-	USIZE sz;
-	LogData* ldata = get_logdata(thread_id, img_name);
-	if (myfile.is_open() && myfile.good())
+	//interval timers are not inherited by the child
+	setitimer(ITIMER_VIRTUAL, &Interval, NULL);
+	//neither are the internal threads of the parent: the checkpointer is restarted,
+	//the control channel stays with the first process (its socket path is taken)
+	Ckpt_Thread_Started = false;
+	Ctl_Thread_Started = false;
+	//the child writes its own log files: log_<thread>-<n>_<image>.out for the n-th child
+	Log_Tag += "-" + decstr(Fork_Num[thread_id]);
+	Fork_Count = 0;
+	if(Redun_Suppress)
 	{
-		while(getline (myfile,line,'\n'))
+		dime_logs_fork_child();
+		if(KnobCheckpoint.Value() > 0)
 		{
-			istringstream iss;
-			iss.str(line);
-			if(Run_Num > 1)//log
-			{
-				iss >> tr >> sz;
-				ldata->Log[tr] = sz;
-			}
+			Ckpt_Thread_Started = (PIN_SpawnInternalThread(dime_checkpoint_thread, NULL, 0, &Ckpt_Thread_Uid) != INVALID_THREADID);
 		}
-		ret = 1;
-	 }
-	 myfile.close();	
-	 return ret;
-}
-/* ----------------------------------------------------------------- */
-//Alarm handler of alarm_reset
-VOID handler_reset(int signum)
-{
-	Alarm_Fired = true;
-	//print budget before reset (for testing)
-	Budget_Array[Counter++] = Budget_Dec;
-	//Reset Budget
-    Budget_Dec = Budget;
-}
-/* ----------------------------------------------------------------- */
-// returns 1 if we should switch to heavyweight instrumentation 
-static inline int dime_has_budget()
-{    
-    return (Budget_Dec > 0);//this gets inlined
+	}
+	Pool_Drawn_Total = 0;
+	Pace_Tick = 0;
+	if(Pool != NULL && dime_pool_register())
+	{
+		Budget_Dec = 0;//draw from the pool
+		Pool_Retry = 0;
+	}
+	else
+	{
+		Pool = NULL;
+		Budget_Dec = Slot_Budget;
+	}
+	if(Steal_Enabled)
+	{
+		dime_slices_grant(Budget_Dec, false);
+	}
 }
-
 /* ================================================================= */
 /* ----------------------- Switching Versions ---------------------- */
 /*	From Pin Documentation:
@@ -164,7 +167,15 @@ static inline int dime_has_budget()
 /* TV: Switches version if required */
 static inline void dime_switch_version(ADDRINT version, INS ins)
 {
-    INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(dime_has_budget), IARG_RETURN_REGS, Version_Reg,IARG_END);	
+    if(Steal_Enabled) {
+        INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(dime_has_budget_thread), IARG_THREAD_ID, IARG_RETURN_REGS, Version_Reg,IARG_END);
+    }
+    else if(Pool != NULL) {
+        INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(dime_has_budget_pool), IARG_THREAD_ID, IARG_RETURN_REGS, Version_Reg,IARG_END);
+    }
+    else {
+        INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(dime_has_budget), IARG_THREAD_ID, IARG_RETURN_REGS, Version_Reg,IARG_END);
+    }
 	if(version == VERSION_BASE) {  //check if you need to switch to VERSION_INSTRUMENT
 		INS_InsertVersionCase(ins, Version_Reg, 1, VERSION_INSTRUMENT, IARG_END);      
 	}
@@ -173,162 +184,646 @@ static inline void dime_switch_version(ADDRINT version, INS ins)
 	}
 }
 
+/* ================================================================= */
+/* ------------------------ Trace keys ----------------------------- */
+/*	The traces are recorded in the log by key. With -key addr (default) the key is the
+	image-relative address of the trace. With -key hash the key is a hash (XXH64) of the
+	trace's instruction bytes, seeded with the trace size, so the log still matches after
+	a rebuild that moves the code. The bytes that change when the code moves are zeroed
+	before hashing: the displacements of direct branches and calls (rel8/rel32) and of
+	rip-relative operands, found by walking the instructions of the trace with XED. In
+	their place, the identity of the address they reference is mixed into the hash: the
+	routine name and the offset in the routine, else the image name and the offset in the
+	image. So "call malloc" and "call free" (or two PLT stubs) keep different keys. The
+	hash is computed once per trace and cached.
+*/
+static const UINT64 XXH_PRIME1 = 0x9E3779B185EBCA87ULL;
+static const UINT64 XXH_PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const UINT64 XXH_PRIME3 = 0x165667B19E3779F9ULL;
+static const UINT64 XXH_PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const UINT64 XXH_PRIME5 = 0x27D4EB2F165667C5ULL;
+/* ----------------------------------------------------------------- */
+static inline UINT64 dime_rotl64(UINT64 x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
 /* ----------------------------------------------------------------- */
+static inline UINT64 dime_read64(const UINT8* p)
+{
+	UINT64 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+/* ----------------------------------------------------------------- */
+static inline UINT64 dime_xxh_round(UINT64 acc, UINT64 input)
+{
+	acc += input * XXH_PRIME2;
+	acc = dime_rotl64(acc, 31);
+	return acc * XXH_PRIME1;
+}
+/* ----------------------------------------------------------------- */
+static inline UINT64 dime_xxh_merge(UINT64 acc, UINT64 val)
+{
+	acc ^= dime_xxh_round(0, val);
+	return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+/* ----------------------------------------------------------------- */
+// XXH64 of len bytes
+static inline UINT64 dime_hash_bytes(const UINT8* p, size_t len, UINT64 seed)
+{
+	const UINT8* end = p + len;
+	UINT64 h;
+	if(len >= 32)
+	{
+		UINT64 v1 = seed + XXH_PRIME1 + XXH_PRIME2;
+		UINT64 v2 = seed + XXH_PRIME2;
+		UINT64 v3 = seed;
+		UINT64 v4 = seed - XXH_PRIME1;
+		for(; p + 32 <= end; p += 32)
+		{
+			v1 = dime_xxh_round(v1, dime_read64(p));
+			v2 = dime_xxh_round(v2, dime_read64(p + 8));
+			v3 = dime_xxh_round(v3, dime_read64(p + 16));
+			v4 = dime_xxh_round(v4, dime_read64(p + 24));
+		}
+		h = dime_rotl64(v1, 1) + dime_rotl64(v2, 7) + dime_rotl64(v3, 12) + dime_rotl64(v4, 18);
+		h = dime_xxh_merge(h, v1);
+		h = dime_xxh_merge(h, v2);
+		h = dime_xxh_merge(h, v3);
+		h = dime_xxh_merge(h, v4);
+	}
+	else
+	{
+		h = seed + XXH_PRIME5;
+	}
+	h += len;
+	for(; p + 8 <= end; p += 8)
+	{
+		h ^= dime_xxh_round(0, dime_read64(p));
+		h = dime_rotl64(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+	}
+	if(p + 4 <= end)
+	{
+		UINT32 v;
+		memcpy(&v, p, sizeof(v));
+		h ^= (UINT64)v * XXH_PRIME1;
+		h = dime_rotl64(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+		p += 4;
+	}
+	for(; p < end; p++)
+	{
+		h ^= (*p) * XXH_PRIME5;
+		h = dime_rotl64(h, 11) * XXH_PRIME1;
+	}
+	h ^= h >> 33;
+	h *= XXH_PRIME2;
+	h ^= h >> 29;
+	h *= XXH_PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+/* ----------------------------------------------------------------- */
+// position-independent identity of an address referenced by the code
+static inline UINT64 dime_target_identity(ADDRINT target)
+{
+	string name;
+	ADDRINT offset = target;//no routine and no image: the address itself
+	RTN rtn = RTN_FindByAddress(target);
+	if(RTN_Valid(rtn))
+	{
+		name = RTN_Name(rtn);
+		offset = target - RTN_Address(rtn);
+	}
+	else
+	{
+		IMG img = IMG_FindByAddress(target);
+		if(IMG_Valid(img))
+		{
+			name = get_simple_img_name(IMG_Name(img).c_str());
+			offset = target - IMG_LowAddress(img);
+		}
+	}
+	return dime_hash_bytes(reinterpret_cast<const UINT8*>(name.data()), name.size(), offset);
+}
+/* ----------------------------------------------------------------- */
+// zeroes the bytes of the trace that change when the code moves (bytes[0] is at TRACE_Address),
+// returns the combined identities of the addresses they referenced
+static inline UINT64 dime_mask_moving_bytes(TRACE trace, std::vector<UINT8>& bytes)
+{
+	UINT64 targets = 0;
+	ADDRINT base = TRACE_Address(trace);
+	for(BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+	{
+		for(INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+		{
+			size_t end = INS_Address(ins) - base + INS_Size(ins);
+			if(end > bytes.size()) continue;//not copied
+			xed_decoded_inst_t* xedd = INS_XedDec(ins);
+			size_t width = 0;//bytes of the displacement
+			size_t tail = 0;//bytes after it (immediate)
+			ADDRINT target = 0;//address referenced through the displacement
+			if(INS_IsDirectBranchOrCall(ins))
+			{
+				width = xed_decoded_inst_get_branch_displacement_width(xedd);
+				target = INS_DirectBranchOrCallTargetAddress(ins);
+			}
+			else
+			{
+				for(UINT32 i = 0; i < INS_OperandCount(ins); i++)
+				{
+					if((INS_OperandIsMemory(ins, i) || INS_OperandIsAddressGenerator(ins, i)) &&
+					   INS_OperandMemoryBaseReg(ins, i) == REG_INST_PTR)
+					{
+						width = xed_decoded_inst_get_memory_displacement_width(xedd, 0);
+						tail = xed_decoded_inst_get_immediate_width(xedd);
+						target = INS_Address(ins) + INS_Size(ins) + INS_OperandMemoryDisplacement(ins, i);
+						break;
+					}
+				}
+			}
+			if(width > 0 && width + tail <= INS_Size(ins))
+			{
+				memset(&bytes[end - tail - width], 0, width);
+				targets = dime_key(targets, dime_target_identity(target));
+			}
+		}
+	}
+	return targets;
+}
+/* ----------------------------------------------------------------- */
+// returns the log key of the trace (see -key); call it in the instrumentation routine
+static inline UINT64 dime_trace_key(TRACE trace, UINT64 trace_rel_addr)
+{
+	if(!Key_By_Hash)
+	{
+		return trace_rel_addr;
+	}
+	ADDRINT addr = TRACE_Address(trace);
+	USIZE size = TRACE_Size(trace);
+	UINT64 cache_key = dime_key(addr, size);
+	std::unordered_map<UINT64,UINT64>::iterator it = Key_Cache.find(cache_key);
+	if(it != Key_Cache.end())
+	{
+		return it->second;
+	}
+	std::vector<UINT8> bytes(size);
+	size_t copied = PIN_SafeCopy(bytes.data(), reinterpret_cast<VOID*>(addr), size);
+	bytes.resize(copied);
+	UINT64 targets = dime_mask_moving_bytes(trace, bytes);
+	UINT64 key = dime_key(dime_hash_bytes(bytes.data(), copied, size), targets);
+	Key_Cache[cache_key] = key;
+	return key;
+}
 /* ================================================================= */
-
-static inline void dime_start_time()
+/* ---------------------------- Filters ---------------------------- */
+/*	The filters select the code that gets instrumented:
+		-img_include / -img_exclude <glob>	image name (full path or file name), e.g. "libc.so*"
+		-sym_include / -sym_exclude <prefix>	routine name prefix, demangled, e.g. "std::"
+		-range_include / -range_exclude <lo:hi>	address range [lo, hi), e.g. 0x400000:0x401000
+	Each option can be given several times. If there is no include filter, all code is
+	included. An excluded address is never instrumented, even if it is also included.
+	The filters are compiled at image load into a sorted table of address ranges, and the
+	tools call dime_filter_trace() once per trace, before any version switch is inserted.
+	Only the first address of the trace is checked.
+*/
+struct FilterInterval
+{
+	ADDRINT Low;
+	ADDRINT High;//exclusive
+	BOOL Exclude;
+	UINT32 Img;//IMG_Id of the image the interval comes from, 0 for -range_*
+};
+static BOOL Filter_Enabled = false;//at least one filter is given
+static BOOL Filter_Default = true;//state of addresses that no include filter covers
+std::vector<FilterInterval> Filter_Intervals;
+std::vector<ADDRINT> Filter_Starts;//sorted, Filter_Starts[0] == 0
+std::vector<UINT8> Filter_Allow;//Filter_Allow[i]: state of [Filter_Starts[i], Filter_Starts[i+1])
+/* ----------------------------------------------------------------- */
+struct FilterEdge
 {
-	rdtsc(Low_S,High_S);
+	ADDRINT Addr;
+	INT32 Include;//+1 at the start of an include interval, -1 at its end
+	INT32 Exclude;
+	bool operator<(const FilterEdge& other) const { return Addr < other.Addr; }
+};
+// rebuilds Filter_Starts and Filter_Allow from Filter_Intervals (sweep over the interval edges)
+static inline void dime_filter_build()
+{
+	std::vector<FilterEdge> edges;
+	for(size_t i = 0; i < Filter_Intervals.size(); i++)
+	{
+		FilterInterval& in = Filter_Intervals[i];
+		if(in.High <= in.Low) continue;
+		FilterEdge lo = {in.Low, in.Exclude ? 0 : 1, in.Exclude ? 1 : 0};
+		FilterEdge hi = {in.High, in.Exclude ? 0 : -1, in.Exclude ? -1 : 0};
+		edges.push_back(lo);
+		edges.push_back(hi);
+	}
+	std::sort(edges.begin(), edges.end());
+	Filter_Starts.assign(1, 0);
+	Filter_Allow.assign(1, Filter_Default);
+	INT32 include = 0, exclude = 0;
+	for(size_t i = 0; i < edges.size(); )
+	{
+		ADDRINT addr = edges[i].Addr;
+		for(; i < edges.size() && edges[i].Addr == addr; i++)
+		{
+			include += edges[i].Include;
+			exclude += edges[i].Exclude;
+		}
+		UINT8 allow = (exclude == 0) && (include > 0 || Filter_Default);
+		if(allow == Filter_Allow.back()) continue;
+		if(addr == Filter_Starts.back())
+		{
+			Filter_Allow.back() = allow;
+		}
+		else
+		{
+			Filter_Starts.push_back(addr);
+			Filter_Allow.push_back(allow);
+		}
+	}
 }
 /* ----------------------------------------------------------------- */
-static inline void dime_end_time()
+// returns true if the trace at addr should be instrumented
+// branch-free binary search: the loop runs log2(ranges) times and compiles to a conditional move
+static inline bool dime_filter_trace(ADDRINT addr)
 {
-	rdtsc(Low_E,High_E);
-	Budget_Dec -= (Low_E - Low_S)*1000/Freq;
-	//Note: we ignore High_E and High_S since Analysis routine can never exceed 3.5 sec
+	if(!Filter_Enabled) return true;
+	const ADDRINT* base = Filter_Starts.data();
+	size_t n = Filter_Starts.size();
+	while(n > 1)
+	{
+		size_t half = n / 2;
+		base = (base[half] <= addr) ? base + half : base;
+		n -= half;
+	}
+	return Filter_Allow[base - Filter_Starts.data()];
 }
 /* ----------------------------------------------------------------- */
-static inline bool dime_compare_to_log(THREADID thread_id, UINT64 trace_rel_addr, USIZE trace_size, char* img_name)
+static inline void dime_filter_add(ADDRINT low, ADDRINT high, BOOL exclude, UINT32 img_id)
 {
-	bool ret_val = 0;
-	if(Redun_Suppress)
+	FilterInterval in = {low, high, exclude, img_id};
+	Filter_Intervals.push_back(in);
+}
+/* ----------------------------------------------------------------- */
+// number of non-empty values of a filter knob
+static inline UINT32 dime_knob_count(const KNOB<string>& knob)
+{
+	UINT32 count = 0;
+	for(UINT32 i = 0; i < knob.NumberOfValues(); i++)
 	{
-	    std::unordered_map<UINT64,USIZE>::iterator Iterator;
-	    LogData* ldata = get_logdata(thread_id, img_name);
-	    if(ldata->Log.empty())
-	    {
-		    ret_val = 1;
-	    }
-	    else
-	    {
-		    ldata->Total_Test++;
-		    Iterator = ldata->Log.find(trace_rel_addr);
-		    //avg. case: constant, worst case: linear
-		    //check keys only (range checking is not possible)
-		    if(Iterator == ldata->Log.end())//not found
-		    {
-			    ret_val = 1;
-		    }
-		    else
-		    {
-			    //found as key
-			    ret_val = 0;
-		    }
-	    }
-	}
-	return ret_val;
+		if(!knob.Value(i).empty()) count++;
+	}
+	return count;
 }
 /* ----------------------------------------------------------------- */
-static inline void dime_modify_log(ADDRINT version, THREADID thread_id, UINT64 trace_rel_addr, USIZE trace_size, char* img_name)
+static inline bool dime_glob_match(const KNOB<string>& knob, const string& name)
 {
-    if(Redun_Suppress)
+	string simple_name = get_simple_img_name(name.c_str());
+	for(UINT32 i = 0; i < knob.NumberOfValues(); i++)
 	{
-	    std::unordered_map<UINT64,USIZE>::iterator Iterator;
-	    LogData* ldata = get_logdata(thread_id, img_name);
-	    USIZE new_size;
-	    if(version == VERSION_BASE && trace_rel_addr == ldata->Previous_Trace)
-	    {
-		    //handle the case in which: the trace initialy has version 1, 
-		    //then Pin checks budget, accordingly the trace switches to version 0
-		    //therefore, remove this trace from the log
-		    if(ldata->Log.erase(trace_rel_addr) != 1)
-		    {
-			    ostringstream ss;
-			    ss <<  "Error " << trace_rel_addr;
-			    ldata->Errors += ss.str();
-			    ldata->Errors += " not erased\n";
-		    }
-		    ldata->Previous_Trace = 0;
-		    ldata->Previous_Size = 0;
-	    }
-	    else if(version == VERSION_INSTRUMENT)//record instrumented trace
-	    {
-		    ldata->Log[trace_rel_addr] = trace_size;
-		    //avg. case: constant, worst case: linear
-		    ldata->Previous_Trace = trace_rel_addr;
-		    ldata->Previous_Size = trace_size;
-		
-		    ldata->Positives[ldata->Indx_Pos][0] = trace_rel_addr;
-		    ldata->Positives[ldata->Indx_Pos][1] = trace_size;
-		    ldata->Indx_Pos++;
-	    }
+		const char* pattern = knob.Value(i).c_str();
+		if(pattern[0] == '\0') continue;
+		if(fnmatch(pattern, name.c_str(), 0) == 0 || fnmatch(pattern, simple_name.c_str(), 0) == 0)
+			return true;
+	}
+	return false;
+}
+/* ----------------------------------------------------------------- */
+static inline bool dime_prefix_match(const KNOB<string>& knob, const string& name)
+{
+	for(UINT32 i = 0; i < knob.NumberOfValues(); i++)
+	{
+		if(!knob.Value(i).empty() && name.compare(0, knob.Value(i).size(), knob.Value(i)) == 0)
+			return true;
+	}
+	return false;
+}
+/* ----------------------------------------------------------------- */
+// adds the ranges of a loaded image that match the image and symbol filters
+static inline void dime_filter_image(IMG img)
+{
+	if(!Filter_Enabled) return;
+	UINT32 img_id = IMG_Id(img);
+	const string& name = IMG_Name(img);
+	ADDRINT low = IMG_LowAddress(img);
+	ADDRINT high = IMG_HighAddress(img) + 1;
+	if(dime_glob_match(KnobImgInclude, name)) dime_filter_add(low, high, false, img_id);
+	if(dime_glob_match(KnobImgExclude, name)) dime_filter_add(low, high, true, img_id);
+	if(dime_knob_count(KnobSymInclude) > 0 || dime_knob_count(KnobSymExclude) > 0)
+	{
+		for(SEC sec = IMG_SecHead(img); SEC_Valid(sec); sec = SEC_Next(sec))
+		{
+			for(RTN rtn = SEC_RtnHead(sec); RTN_Valid(rtn); rtn = RTN_Next(rtn))
+			{
+				//RTN_Name() is mangled: the prefixes match the demangled name (or the mangled one)
+				const string& rtn_name = RTN_Name(rtn);
+				string name_only = PIN_UndecorateSymbolName(rtn_name, UNDECORATION_NAME_ONLY);
+				ADDRINT start = RTN_Address(rtn);
+				if(dime_prefix_match(KnobSymInclude, name_only) || dime_prefix_match(KnobSymInclude, rtn_name))
+					dime_filter_add(start, start + RTN_Size(rtn), false, img_id);
+				if(dime_prefix_match(KnobSymExclude, name_only) || dime_prefix_match(KnobSymExclude, rtn_name))
+					dime_filter_add(start, start + RTN_Size(rtn), true, img_id);
+			}
+		}
+	}
+	dime_filter_build();
+}
+/* ----------------------------------------------------------------- */
+// removes the ranges of an unloaded image
+static inline void dime_filter_unload(IMG img)
+{
+	if(!Filter_Enabled) return;
+	UINT32 img_id = IMG_Id(img);
+	size_t kept = 0;
+	for(size_t i = 0; i < Filter_Intervals.size(); i++)
+	{
+		if(Filter_Intervals[i].Img != img_id) Filter_Intervals[kept++] = Filter_Intervals[i];
+	}
+	Filter_Intervals.resize(kept);
+	dime_filter_build();
+}
+/* ----------------------------------------------------------------- */
+// reads the -range_* knobs ("lo:hi") and sets the default state
+static inline void dime_filter_init()
+{
+	Filter_Enabled = dime_knob_count(KnobImgInclude) + dime_knob_count(KnobImgExclude) +
+	                 dime_knob_count(KnobSymInclude) + dime_knob_count(KnobSymExclude) +
+	                 dime_knob_count(KnobRangeInclude) + dime_knob_count(KnobRangeExclude) > 0;
+	Filter_Default = (dime_knob_count(KnobImgInclude) + dime_knob_count(KnobSymInclude) +
+	                  dime_knob_count(KnobRangeInclude) == 0);
+	for(int exclude = 0; exclude < 2; exclude++)
+	{
+		const KNOB<string>& knob = exclude ? KnobRangeExclude : KnobRangeInclude;
+		for(UINT32 i = 0; i < knob.NumberOfValues(); i++)
+		{
+			const char* range = knob.Value(i).c_str();
+			if(range[0] == '\0') continue;
+			char* end;
+			ADDRINT low = strtoull(range, &end, 0);
+			if(*end != ':')
+			{
+				LOG("Ignoring address range " + knob.Value(i) + " (expected lo:hi)\n");
+				continue;
+			}
+			ADDRINT high = strtoull(end + 1, NULL, 0);
+			dime_filter_add(low, high, exclude, 0);
+		}
+	}
+	dime_filter_build();
+}
+/* ----------------------------------------------------------------- */
+// an unloaded image may be replaced by other code at the same addresses
+VOID ImageUnload(IMG img, VOID *v)
+{
+	Key_Cache.clear();
+	dime_filter_unload(img);
+}
+/* ================================================================= */
+/* ----------------------- Checkpointer thread --------------------- */
+/* ----------------------------------------------------------------- */
+// Pin internal thread: checkpoints the logs every -ckpt seconds
+static VOID dime_checkpoint_thread(VOID* arg)
+{
+	UINT32 period_ms = (UINT32)(KnobCheckpoint.Value() * 1000);
+	while(!Ckpt_Stop)
+	{
+		for(UINT32 slept = 0; slept < period_ms && !Ckpt_Stop; slept += 100)
+		{
+			PIN_Sleep(100);
+		}
+		if(!Ckpt_Stop) dime_checkpoint();
+	}
+}
+/* ================================================================= */
+/* ------------------------- Control channel ----------------------- */
+/*	With -ctl <path>, a Pin internal thread serves a Unix-domain socket at <path>.
+	Each line sent to the socket is one command, answered by one line ("ok ..." or "error ..."):
+		budget <percent>	budget percentage from the next period
+		period <seconds>	time period from the next period
+		pause			no instrumentation from the next period
+		resume			instrumentation again from the next period
+		flush			checkpoint the redundancy-suppression logs now
+		stat			write the budget values so far to pintool.log, answer the current settings
+	With -shared_budget 1, budget and period set the budget pool of the whole fork tree (the
+	answer gives the pool budget and the share of each process); pause and resume apply to
+	this process only. The socket path must not exist, or be a socket that nobody serves.
+	e.g. echo "budget 5" | socat - UNIX-CONNECT:<path>
+*/
+/* ----------------------------------------------------------------- */
+// answers one command of the control channel
+static inline string dime_control_command(const string& line, DimeConfig* next)
+{
+	istringstream iss(line);
+	string cmd;
+	iss >> cmd;
+	ostringstream reply;
+	if(cmd == "budget" || cmd == "period")
+	{
+		float value;
+		if(!(iss >> value) || value <= 0 || (cmd == "budget" && value > 100))
+		{
+			return "error bad value";
+		}
+		if(cmd == "budget") next->Percent = value;
+		else next->Period = value;
+		dime_request_config(*next);
+		reply << "ok " << cmd << " " << value << " from the next period";
+		if(Pool != NULL)
+		{
+			//the budget goes to the pool of the fork tree, each process draws its share
+			INT64 total = (INT64)(next->Percent / 100 * next->Period * sec_to_nsec);
+			INT32 active = Pool->Active;
+			reply << ": pool " << total << "ns per " << next->Period << "s epoch, " << total / (active > 0 ? active : 1)
+			      << "ns per process (" << active << " processes)";
+		}
 	}
+	else if(cmd == "pause" || cmd == "resume")
+	{
+		next->Paused = (cmd == "pause");
+		dime_request_config(*next);
+		reply << "ok " << cmd << " from the next period";
+		if(Pool != NULL) reply << " (this process only)";
+	}
+	else if(cmd == "flush")
+	{
+		if(Redun_Suppress) dime_checkpoint();
+		reply << "ok flushed";
+	}
+	else if(cmd == "stat")
+	{
+		INT32 periods = Counter;
+		LOG("#stat (BUDGET = " + decstr(Budget) + "ns) periods = " + decstr(periods) + "\n");
+		for (int i = 0; i < periods && i < MAX_SIZE; i++){
+			LOG(decstr(Budget_Array[i]) + "\n");
+		}
+		LOG("#eof\n");
+		reply << "ok budget " << Budget_Percent << " period " << Period_Sec << " paused " << (Paused ? 1 : 0)
+		      << " periods " << periods << " last " << (periods > 0 ? Budget_Array[(periods - 1) % MAX_SIZE] : 0);
+	}
+	else
+	{
+		return "error unknown command: " + cmd;
+	}
+	LOG("ctl: " + line + "\n");
+	return reply.str();
 }
 /* ----------------------------------------------------------------- */
-//helper function
-// split img name by '/', return last token
-// e.g. input= /lib/x86_64-linux-gnu/libc.so.6 output= libc.so.6
-char* get_simple_img_name(char* str)
+// reads the commands of one client until it disconnects
+static inline void dime_control_session(int client, DimeConfig* next)
 {
-	std::istringstream ss(str); //convert string to stream
-	std::string tok; //temp
-	std::string ret_str; //return string
-	while(std::getline(ss, tok, '/')) { }
-	return (char*)tok.c_str(); //return last token
+	string pending;
+	char buf[256];
+	while(!Ctl_Stop)
+	{
+		struct pollfd pfd = {client, POLLIN, 0};
+		if(poll(&pfd, 1, 100) <= 0) continue;
+		ssize_t n = read(client, buf, sizeof(buf));
+		if(n <= 0) return;
+		pending.append(buf, n);
+		size_t eol;
+		while((eol = pending.find('\n')) != string::npos)
+		{
+			string line = pending.substr(0, eol);
+			pending.erase(0, eol + 1);
+			if(line.empty()) continue;
+			string reply = dime_control_command(line, next) + "\n";
+			if(!dime_write_all(client, reply)) return;
+		}
+	}
+}
+/* ----------------------------------------------------------------- */
+// Pin internal thread: serves the control socket
+static VOID dime_control_thread(VOID* arg)
+{
+	string path = KnobControl.Value();
+	DimeConfig next;//settings requested so far
+	next.Percent = Budget_Percent;
+	next.Period = Period_Sec;
+	next.Paused = false;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+	//replace only a stale socket: not another file, nor the socket of a running process
+	struct stat st;
+	if(lstat(path.c_str(), &st) == 0)
+	{
+		int probe = S_ISSOCK(st.st_mode) ? socket(AF_UNIX, SOCK_STREAM, 0) : -1;
+		bool stale = (probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) != 0);
+		if(probe >= 0) close(probe);
+		if(!stale)
+		{
+			LOG("Dime control channel failed: " + path + " exists and is not a stale socket\n");
+			if(fd >= 0) close(fd);
+			return;
+		}
+		unlink(path.c_str());
+	}
+	if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0)
+	{
+		LOG("Dime control channel failed on " + path + " ErrNo = " + decstr(errno) + "\n");
+		if(fd >= 0) close(fd);
+		return;
+	}
+	while(!Ctl_Stop)
+	{
+		struct pollfd pfd = {fd, POLLIN, 0};
+		if(poll(&pfd, 1, 100) <= 0) continue;
+		int client = accept(fd, NULL, NULL);
+		if(client < 0) continue;
+		dime_control_session(client, &next);
+		close(client);
+	}
+	close(fd);
+	unlink(path.c_str());
+}
+/* ----------------------------------------------------------------- */
+// stops the internal threads (checkpointer, control channel) before the application exits
+static VOID dime_prepare_fini(VOID* v)
+{
+	Ckpt_Stop = true;
+	Ctl_Stop = true;
+	if(Ckpt_Thread_Started)
+	{
+		PIN_WaitForThreadTermination(Ckpt_Thread_Uid, PIN_INFINITE_TIMEOUT, NULL);
+	}
+	if(Ctl_Thread_Started)
+	{
+		PIN_WaitForThreadTermination(Ctl_Thread_Uid, PIN_INFINITE_TIMEOUT, NULL);
+	}
 }
 
 //1. for testing: writes Budget_Array to pintool.log using LOG() 
 //   (Budget_Array holds the budget values before reset)
-//2. writes redundancy-suppression Log to logfile
+//2. writes the last changes of the redundancy-suppression Logs to the log files
 static inline void dime_fini()
 {
 	//write overshoots to pintool.log
 	LOG("#begin (BUDGET = " + decstr(Budget) +  "ns)\n");
-	LOG("#Interval = " + decstr(Interval.it_value.tv_sec) + " sec + " + decstr(Interval.it_value.tv_usec) + " usec\n" );
+	//the period; with -pace the timer fires once per slot
+	LOG("#Interval = " + decstr((INT64)Period_Sec) + " sec + " + decstr((INT64)(fmod(Period_Sec, 1.0)*sec_to_usec)) + " usec\n" );
+	LOG("#pace = " + decstr(Pace_Slots) + " slots of " + decstr(Interval.it_value.tv_sec) + " sec + " + decstr(Interval.it_value.tv_usec) + " usec\n" );
+    dime_close_sampling();
     for (int i = 0; i < Counter; i++){
         LOG(decstr(Budget_Array[i]) + "\n");
     }
     LOG("#eof\n");
+    //write sampling statistics: budget checks, checks that found budget and recorded events per period
+    LOG("#sampling (checks active_checks events)\n");
+    for (int i = 0; i < Counter; i++){
+        LOG(decstr(Checks_Array[i]) + " " + decstr(Active_Array[i]) + " " + decstr(Events_Array[i]) + "\n");
+    }
+    LOG("#estimate recorded = " + decstr(Est_Recorded) + " total = " + fltstr(Est_Total, 0) +
+        " +- " + fltstr(1.96 * Est_Rel_Err * Est_Total, 0) + " (95%) scale = " + fltstr(Est_Scale, 4) + "\n");
+    LOG("#eof\n");
+    dime_stretch_report();
+    dime_slices_report();
+    
+    //give the slot and the unused budget back to the shared pool
+    dime_pool_exit();
+    
+    //flush the output shards of the threads that are still running
+    for(int t = 0; t < Num_Threads; t++)
+    {
+        dime_shard_close(t);
+    }
     
     if(Redun_Suppress)
     {
-        char* img_name;
-        char* simple_img_name;
-        LogData log_data;    
-        string file;
-        ofstream logfile;
-        ofstream Rfile;
-        //for each thread, for each img : write to a log file & write to a run file
-        for(int t = 0; t < Num_Threads; t++)
-	    {
-	       ThreadData* tdata = get_tls(t);
-	       for ( auto it0 = tdata->Img_Logs.begin(); it0 != tdata->Img_Logs.end(); ++it0 )
-	       {
-	            //it0->first is the img name, it0->second is the log data
-	            img_name = it0->first;
-	            log_data = it0->second;
-	            simple_img_name = get_simple_img_name(img_name) ; // get rid of '/' in img_name
-	            // *** Log File ***
-	            //log file name: log _ threadid _ simpleImgName .out
-	            ostringstream ss;
-	            ss << "_" << (t + 1) << "_" << simple_img_name; //threadid_imgname
-             	file = "log";
-             	file += ss.str();
-             	file += ".out";
-	            //write to log file
-	            logfile.open(file, std::ofstream::out);
-	            for ( auto it = log_data.Log.begin(); it != log_data.Log.end(); ++it )
-	            {
-		            logfile << it->first << " " << it->second << endl;
-	            }
-	            logfile.close();
-	       }
-	    }
+        //for each thread, for each img : append the changes since the last checkpoint
+        dime_checkpoint();
 	}
 
 }
 /* ----------------------------------------------------------------- */
+// may be called twice for a thread: by the tool and by dime_thread_start_cb() (-steal, -r)
 static inline void dime_thread_start(THREADID thread_id)
 {
-    if(thread_id > 0) //if not first thread
+    if(Steal_Enabled) dime_slice_start(thread_id);
+    if(thread_id > 0 && get_tls(thread_id) == NULL) //if not first thread, nor registered yet
     {
     	GetLock(&Lock, thread_id+1);
-    	Num_Threads++;
+    	if((INT32)thread_id >= Num_Threads) Num_Threads = thread_id + 1;
     	ReleaseLock(&Lock);
     	ThreadData* tdata = new ThreadData;
     	PIN_SetThreadData(Tls_Key, tdata, thread_id);
+    	LOG("Thread " + decstr(thread_id) + "\n");
     }
-    LOG("Thread " + decstr(thread_id) + "\n");
+}
+/* ----------------------------------------------------------------- */
+// ThreadStart callback of DIME itself, when every thread needs its data (-steal, -r)
+static VOID dime_thread_start_cb(THREADID thread_id, CONTEXT* ctxt, INT32 flags, VOID* v)
+{
+    dime_thread_start(thread_id);
+}
+/* ----------------------------------------------------------------- */
+// ThreadFini callback of DIME itself (-steal): the budget of the thread goes to the others
+static VOID dime_thread_fini_cb(THREADID thread_id, const CONTEXT* ctxt, INT32 code, VOID* v)
+{
+    dime_slice_exit(thread_id);
 }
 
 VOID ImageLoad(IMG img, VOID *v)
@@ -340,34 +835,31 @@ VOID ImageLoad(IMG img, VOID *v)
 	if(Run_Num > 1 && Redun_Suppress)
 	{
 		//read log data of current image & current thread from file
-		//log file name: log _ threadid _ simpleImgName .out
-		ostringstream os;
-		string file = "log";
-		os << "_" << (thread_id+1) << "_" << get_simple_img_name(img_name);
-		file += os.str();//threadid_imgname
-		file += ".out";
-		read_log(file, thread_id, img_name);
+		read_log(get_log_file_name(thread_id, img_name), thread_id, img_name);
 	}
+	dime_filter_image(img);
 	LOG("loading img " + decstr(img_id) + " " + img_name + " " + decstr(thread_id) + "\n");
 }
 
 /* ----------------------------------------------------------------- */
 // Dime initialization function
 // Sets Dime parameters
-static inline void dime_init(char *filename1, char *filename2, int percent, int t_sec, int t_usec)
+static inline void dime_init()
 {
-	// to reset budget every period_t_sec seconds plus period_t_usec microseconds */
+	// to reset budget every period_t seconds
 	float period_t;//time period in seconds
 	float percentage;//budget percentage from 0% to 100% 
 	// Get Knob values (command line arguments) 
 	// Defaults: budget percentage = 10%, period time = 1 sec */
 	percentage = KnobBudgPercent.Value();
 	period_t = KnobPeriod.Value();
-	// open file
-	Trace_File = fopen (filename1, "w");
-	/* Set Budget */	
-	Budget = ((float)percentage/100) * (period_t_sec * sec_to_nsec + period_t_usec * usec_to_nsec); //% budget in nanoseconds
-	Budget_Dec = Budget;
+	Pace_Slots = (KnobPace.Value() > 1) ? KnobPace.Value() : 1;
+	/* Set Budget and Alarm Interval */	
+	dime_set_budget(percentage, period_t);
+	Budget_Dec = Slot_Budget;
+	Steal_Enabled = KnobSteal.Value();
+	Period_Start_Tsc = dime_rdtsc64();
+	dime_stretch_begin(Period_Start_Tsc);
 	/* Set Alarm */
 	// Alarm handler
 	Alarm_Reset.sa_handler = handler_reset;
@@ -381,12 +873,6 @@ static inline void dime_init(char *filename1, char *filename2, int percent, int
 		return;
 	}
 	// Alarm Interval
-	//to fire the first time
-    Interval.it_value.tv_sec = int(period_t);// seconds
-	Interval.it_value.tv_usec = fmod(period_t, 1.0)*sec_to_usec; //micro seconds
-    //to repeat the alarm
-	Interval.it_interval.tv_sec = int(period_t); //seconds
-    Interval.it_interval.tv_usec = fmod(period_t, 1.0)*sec_to_usec; // micro second
     ret = setitimer(ITIMER_VIRTUAL, &Interval, NULL);   
     if(ret != 0) 
 	{
@@ -403,12 +889,23 @@ static inline void dime_init(char *filename1, char *filename2, int percent, int
 	}
     // Run number for redundancy suppression
     Run_Num = KnobRunNum.Value();
+    // Key of the traces in the logs
+    Key_By_Hash = (KnobKeyMode.Value() == "hash");
+    IMG_AddUnloadFunction(ImageUnload, 0);
+    // Image and address filters
+    dime_filter_init();
     // Register ImageLoad to be called when an image is loaded
     IMG_AddInstrumentFunction(ImageLoad, 0);
     // For trace versioning
 	PIN_InitSymbols();
 	Version_Reg = PIN_ClaimToolRegister();// Scratch register used to select instrumentation version
 	InitLock(&Lock);
+	InitLock(&Log_Lock);
+	InitLock(&Ckpt_Lock);
+	InitLock(&Site_Lock);
+	// Demotion of outlier sites
+	Demote_Multiple = KnobDemote.Value();
+	Demote_Backoff = KnobDemoteBackoff.Value();
     // Obtain  a key for Thread local storage.
     Tls_Key = PIN_CreateThreadDataKey(0);
     //set thread data for the first thread
@@ -417,6 +914,39 @@ static inline void dime_init(char *filename1, char *filename2, int percent, int
     //ReleaseLock(&Lock);
 	ThreadData* tdata = new ThreadData;
 	PIN_SetThreadData(Tls_Key, tdata, 0);
+	if(Steal_Enabled)
+	{
+		dime_slice_start(0);
+		dime_slices_grant(Budget_Dec, false);//the first thread holds the budget until others start
+		PIN_AddThreadFiniFunction(dime_thread_fini_cb, 0);
+	}
+	if(Steal_Enabled || Redun_Suppress)
+	{
+		//a thread gets a slice and a log once registered, whether or not the tool calls dime_thread_start()
+		PIN_AddThreadStartFunction(dime_thread_start_cb, 0);
+	}
+	// Checkpointer of the redundancy-suppression logs
+	if(Redun_Suppress && KnobCheckpoint.Value() > 0)
+	{
+		Ckpt_Thread_Started = (PIN_SpawnInternalThread(dime_checkpoint_thread, NULL, 0, &Ckpt_Thread_Uid) != INVALID_THREADID);
+	}
+	// Control channel
+	if(!KnobControl.Value().empty())
+	{
+		Ctl_Thread_Started = (PIN_SpawnInternalThread(dime_control_thread, NULL, 0, &Ctl_Thread_Uid) != INVALID_THREADID);
+	}
+	if(Ckpt_Thread_Started || Ctl_Thread_Started)
+	{
+		PIN_AddPrepareForFiniFunction(dime_prepare_fini, 0);
+	}
+	// Shared budget of the fork tree
+	if(KnobSharedBudget.Value())
+	{
+		dime_pool_init();
+	}
+	PIN_AddForkFunction(FPOINT_BEFORE, dime_fork_before, 0);
+	PIN_AddForkFunction(FPOINT_AFTER_IN_CHILD, dime_fork_child, 0);
+	PIN_AddFollowChildProcessFunction(dime_exec_child, 0);
 
 }
 
@@ -0,0 +1,1537 @@
+/*
+	DIME core: budget engine, timing probes, sampling statistics and redundancy logs.
+	It uses no Pin instrumentation API, only the subset of pin.H declared by
+	dime_platform.h, so that it also builds with the stub backend of dime_platform.h
+	(see bench/dime_bench.cpp). Pin tools include dime.h, which includes this file.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <signal.h>
+#include <assert.h>
+#include <sys/time.h>
+#include <unordered_map>
+#include <vector>
+#include <string.h>
+#include <math.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fnmatch.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "dime_platform.h"
+
+#define sec_to_nsec 1000000000//from second to nanosecond
+#define usec_to_nsec 1000//from microsecond to nanosecond
+#define sec_to_usec 1000000//from second to microsecond
+#define Freq 3401 //grep 'cpu MHz' /proc/cpuinfo
+#define DIME_SEEN_SIZE 4096 //entries of the per-thread dedupe cache (dime_seen), power of 2
+#define DIME_SHARD_BUF_SIZE (1 << 20) //private output buffer of each thread shard, in bytes
+#define DIME_SHARD_RECORD_MAX 4096 //maximum length of one shard record, longer records are truncated
+#define rdtsc(low,high) \
+     __asm__ __volatile__("rdtsc" : "=a" (low), "=d" (high))
+     
+struct sigaction Alarm_Reset;//alarm to reset the budget using signal.h
+struct itimerval Interval;//used by setitimer()
+static ofstream Trace_File2;//for the overshoots
+static UINT32 Budget;//in nanoseconds
+static float Budget_Percent;//budget percentage from 0% to 100%
+static float Period_Sec;//time period in seconds
+static BOOL Paused = false;//instrumentation paused through the control channel
+static UINT32 Pace_Slots = 1;//slots per period (-pace)
+static UINT32 Pace_Tick = 0;//slots elapsed in the current period
+static INT64 Slot_Budget;//budget granted at each slot, in nanoseconds
+static INT64 Budget_Dec;//variable to decrement, in nanoseconds
+static const INT32 MAX_SIZE = 86400;//enough to write a string of 11 char's every second for a full day
+static INT64 Budget_Array[MAX_SIZE];
+static INT32 Counter = 0;//periods recorded in the arrays, stops at MAX_SIZE
+static volatile INT64 Period_Seq = 0;//periods elapsed, never saturates: use it to tell periods apart
+// Sampling statistics, per period (same index as Budget_Array)
+static UINT64 Checks_Array[MAX_SIZE];//budget checks: event sites reached by the application
+static UINT64 Active_Array[MAX_SIZE];//budget checks that found budget: sites reached while instrumented
+static UINT64 Events_Array[MAX_SIZE];//events recorded by the tool during the period (dime_count_event)
+static UINT64 Period_Start_Tsc = 0;//rdtsc value at the beginning of the current period
+static UINT64 Stretch_Start_Tsc = 0;//rdtsc value when the current instrumented stretch began, 0: budget exhausted
+static UINT64 Stretch_Charged_Tsc = 0;//rdtsc ticks charged to the budget since the current stretch began
+static UINT64 Period_Max_Stretch = 0;//rdtsc ticks charged in the most expensive stretch of the current period
+static UINT32 Stretch_Array[MAX_SIZE];//instrumentation time of the most expensive stretch of each period, in microseconds
+// per-thread counters of the budget checks and events, summed at each period boundary
+struct DimeChecks
+{
+	UINT64 All;//budget checks
+	UINT64 Active;//budget checks that found budget
+	UINT64 Events;//events recorded (dime_count_event)
+	UINT64 Last_All, Last_Active, Last_Events;//values at the last period boundary (alarm handler)
+} __attribute__((aligned(64)));//one cache line per thread
+static DimeChecks Checks[PIN_MAX_THREADS];//indexed by thread id
+static BOOL Sampling_Closed = false;//the last (partial) period was recorded by dime_close_sampling()
+UINT32 Low_S, Low_E;//used by rdtsc()
+UINT32 High_S, High_E;//used by rdtsc()
+static BOOL Alarm_Fired = true;//for TVC
+enum 
+{
+    VERSION_BASE,
+    VERSION_INSTRUMENT
+};
+
+//the log is a hashtable (unordered_map)
+int Run_Num = 1;//DIME run
+BOOL Redun_Suppress = false;//flag if redundancy suppression feature is used
+static TLS_KEY Tls_Key;
+PIN_LOCK Lock;
+INT32 Num_Threads = 0;
+BOOL Key_By_Hash = false;//-key hash
+std::unordered_map<UINT64,UINT64> Key_Cache;//dime_key(trace address, trace size) -> hash key
+//checkpointing of the logs
+PIN_LOCK Log_Lock;//protects Img_Logs, Log and Pending (the checkpointer reads them)
+PIN_LOCK Ckpt_Lock;//one checkpoint at a time
+string Log_Tag = "";//fork children: "-<n>" per fork from the first process, so that their log files differ
+
+// change of a log since the last checkpoint
+struct LogDelta
+{
+    UINT64 Trace;//trace relative address
+    USIZE Size;//trace size, 0: the trace was erased from the log
+};
+
+class LogData
+{
+  public:
+    LogData() : Previous_Trace(0), Previous_Size(0), Total_Test(0), Errors(""), Deltas_Written(0), File_Started(false), Has_Header(false), Discard_File(false) {}
+    std::unordered_map<UINT64,USIZE> Log;//trace relative address, trace size: only for the instrumented traces
+    UINT64 Previous_Trace;//relative address of previous trace whose version = 1
+    USIZE Previous_Size;//size of previous trace whose version = 1
+    int Total_Test;//total number of traces compared to Log
+    string Errors;
+    std::vector<LogDelta> Pending;//changes not written to the log file yet
+    UINT64 Deltas_Written;//lines in the log file, for compaction
+    BOOL File_Started;//the log file was (re)started by this run
+    BOOL Has_Header;//the log file starts with the key mode (get_log_header)
+    BOOL Discard_File;//the log file read at image load has another key mode, overwrite it
+};
+
+// Per-thread output file (see dime_shard_open)
+class DimeShard
+{
+  public:
+    DimeShard() : Fd(-1), Buf(NULL), Pos(0) {}
+    int Fd;//file descriptor, -1 if the shard is not open
+    char* Buf;//private buffer of DIME_SHARD_BUF_SIZE bytes
+    UINT32 Pos;//bytes used in Buf
+};
+
+class ThreadData
+{
+    public:
+	ThreadData(void) { memset(Seen, 0, sizeof(Seen)); }
+	std::unordered_map<char*,LogData> Img_Logs; //<img_name, LogData>: each image in the thread has its own log data
+	UINT64 Seen[DIME_SEEN_SIZE]; //tags of recently emitted events, 0: empty entry (see dime_seen)
+	DimeShard Shard; //output file of the thread, to avoid racing on a shared FILE*
+};
+/* ----------------------------------------------------------------- */
+// function to access Log data of specific image in a specific thread
+// (the map is locked: the checkpointer walks it; the pointer stays valid after a rehash)
+LogData* get_logdata(THREADID thread_id, char* img_name)
+{
+    ThreadData* tdata = 
+          static_cast<ThreadData*>(PIN_GetThreadData(Tls_Key, thread_id));
+    GetLock(&Log_Lock, thread_id+1);
+    LogData* ldata = &(tdata->Img_Logs[img_name]);//inserts the log data of a new image
+    ReleaseLock(&Log_Lock);
+    return ldata;// returns log data of image 
+}
+
+// function to access thread-specific data
+ThreadData* get_tls(THREADID thread_id)
+{
+    ThreadData* tdata = 
+          static_cast<ThreadData*>(PIN_GetThreadData(Tls_Key, thread_id));
+    return tdata;
+}
+/* ----------------------------------------------------------------- */
+//helper function
+// split img name by '/', return last token
+// e.g. input= /lib/x86_64-linux-gnu/libc.so.6 output= libc.so.6
+string get_simple_img_name(const char* str)
+{
+	const char* last = strrchr(str, '/');
+	return (last == NULL) ? string(str) : string(last + 1);
+}
+/* ----------------------------------------------------------------- */
+//log file name: log _ threadid _ simpleImgName .out
+//(log _ threadid-n _ simpleImgName .out in the n-th child forked by the process)
+string get_log_file_name(THREADID thread_id, const char* img_name)
+{
+	ostringstream ss;
+	ss << "log_" << (thread_id + 1) << Log_Tag << "_" << get_simple_img_name(img_name) << ".out";
+	return ss.str();
+}
+/* ----------------------------------------------------------------- */
+//first line of a log file: the key mode of its entries
+//(files written before the key modes existed have no header, their keys are addresses)
+string get_log_header()
+{
+	return Key_By_Hash ? "# key=hash3" : "# key=addr";//hash3: displacements masked, their targets mixed in (dime_mask_moving_bytes)
+}
+/* ----------------------------------------------------------------- */
+//a log file holds one line per change: "trace_rel_addr trace_size" when a trace is added,
+//"- trace_rel_addr" when it is erased; a truncated last line (crash) is ignored
+int read_log(string file, THREADID thread_id, char* img_name)
+{
+	string line;
+	ifstream myfile(file);
+	int ret = 0;
+	UINT64 tr;
+	USIZE sz;
+	LogData* ldata = get_logdata(thread_id, img_name);
+	if (myfile.is_open() && myfile.good())
+	{
+		bool first_line = true;
+		while(getline (myfile,line,'\n'))
+		{
+			istringstream iss;
+			iss.str(line);
+			if(first_line)//header: key mode of the file
+			{
+				first_line = false;
+				string header = (!line.empty() && line[0] == '#') ? line : "# key=addr";
+				if(header != get_log_header())
+				{
+					//keys of another mode are useless: start a new file
+					LOG("Ignoring " + file + ": \"" + header + "\" does not match -key\n");
+					ldata->Discard_File = true;
+					break;
+				}
+				ldata->Has_Header = (header == line);
+				if(ldata->Has_Header) continue;
+			}
+			if(!line.empty() && line[0] == '#')
+			{
+				continue;
+			}
+			if(Run_Num > 1)//log
+			{
+				GetLock(&Log_Lock, thread_id+1);
+				if(!line.empty() && line[0] == '-')
+				{
+					char c;
+					if(iss >> c >> tr) ldata->Log.erase(tr);
+				}
+				else if(iss >> tr >> sz)
+				{
+					ldata->Log[tr] = sz;
+				}
+				ldata->Deltas_Written++;
+				ReleaseLock(&Log_Lock);
+			}
+		}
+		ret = 1;
+	 }
+	 myfile.close();	
+	 return ret;
+}
+/* ----------------------------------------------------------------- */
+static inline UINT64 dime_rdtsc64()
+{
+	UINT32 low, high;
+	rdtsc(low, high);
+	return ((UINT64)high << 32) | low;
+}
+/* ----------------------------------------------------------------- */
+/*	Instrumented stretches: a stretch begins when budget is granted while none was left
+	and ends when the budget runs out. While it lasts, the application runs instrumented.
+	The time charged to the budget during a stretch is the latency that DIME adds to a
+	request at worst; its wall-clock length is not, since it also counts the time the
+	application is blocked (the periods are CPU time, a mostly idle server's stretches
+	are mostly idle). Stretches are cut at the period boundaries: each period records the
+	instrumentation time of its most expensive one (Stretch_Array).
+*/
+// begins a stretch, if none is running
+static inline void dime_stretch_begin(UINT64 now)
+{
+	if(Stretch_Start_Tsc == 0)
+	{
+		Stretch_Start_Tsc = now;
+		Stretch_Charged_Tsc = 0;
+	}
+}
+/* ----------------------------------------------------------------- */
+// ends the running stretch, if any; only the thread that clears Stretch_Start_Tsc records it
+static inline void dime_stretch_end(UINT64 now)
+{
+	UINT64 start = Stretch_Start_Tsc;
+	if(start == 0 || !__sync_bool_compare_and_swap(&Stretch_Start_Tsc, start, 0)) return;
+	if(Stretch_Charged_Tsc > Period_Max_Stretch) Period_Max_Stretch = Stretch_Charged_Tsc;
+}
+/* ----------------------------------------------------------------- */
+// records the sampling statistics of the period that ends now and starts a new one
+static inline void dime_record_period(UINT64 now)
+{
+	dime_stretch_end(now);
+	//the counters only grow: the period gets what they gained since the last boundary
+	UINT64 all = 0, active = 0, events = 0;
+	for(int t = 0; t < PIN_MAX_THREADS; t++)
+	{
+		DimeChecks& c = Checks[t];
+		UINT64 v = c.All;
+		all += v - c.Last_All;
+		c.Last_All = v;
+		v = c.Active;
+		active += v - c.Last_Active;
+		c.Last_Active = v;
+		v = c.Events;
+		events += v - c.Last_Events;
+		c.Last_Events = v;
+	}
+	if(Counter < MAX_SIZE)
+	{
+		Budget_Array[Counter] = Budget_Dec;
+		Checks_Array[Counter] = all;
+		Active_Array[Counter] = active;
+		Events_Array[Counter] = events;
+		Stretch_Array[Counter] = Period_Max_Stretch / Freq;//rdtsc ticks to microseconds
+		Counter++;
+	}
+	Period_Seq++;
+	Period_Start_Tsc = now;
+	Period_Max_Stretch = 0;
+}
+/* ----------------------------------------------------------------- */
+// sets Budget and Interval from the budget percentage and the period in seconds
+// with -pace, the alarm fires at every slot: Pace_Slots times per period
+static inline void dime_set_budget(float percentage, float period_t)
+{
+	Budget_Percent = percentage;
+	Period_Sec = period_t;
+	Budget = ((float)percentage/100) * period_t * sec_to_nsec; //% budget in nanoseconds
+	Slot_Budget = Budget / Pace_Slots;
+	float slot_t = period_t / Pace_Slots;
+	//to fire the first time
+	Interval.it_value.tv_sec = int(slot_t);// seconds
+	Interval.it_value.tv_usec = fmod(slot_t, 1.0)*sec_to_usec; //micro seconds
+	//to repeat the alarm
+	Interval.it_interval = Interval.it_value;
+}
+/* ----------------------------------------------------------------- */
+/*	Settings requested through the control channel. The control thread writes Config_Next
+	between two increments of Config_Seq (odd while writing); the alarm handler copies it
+	at the next period boundary if Config_Seq is even and did not change during the copy.
+*/
+struct DimeConfig
+{
+	float Percent;
+	float Period;
+	BOOL Paused;
+};
+static DimeConfig Config_Next;
+static volatile UINT32 Config_Seq = 0;
+static UINT32 Config_Applied = 0;//Config_Seq of the settings in use
+/* ----------------------------------------------------------------- */
+// control thread: publishes new settings
+static inline void dime_request_config(const DimeConfig& next)
+{
+	Config_Seq++;
+	__sync_synchronize();
+	Config_Next = next;
+	__sync_synchronize();
+	Config_Seq++;
+}
+/* ----------------------------------------------------------------- */
+// alarm handler: switches to the requested settings, returns true if budget or period changed
+static inline bool dime_apply_config()
+{
+	UINT32 seq = Config_Seq;
+	if(seq == Config_Applied || (seq & 1)) return false;//nothing new, or being written
+	__sync_synchronize();
+	DimeConfig next = Config_Next;
+	__sync_synchronize();
+	if(Config_Seq != seq) return false;//changed during the copy: next period
+	Config_Applied = seq;
+	Paused = next.Paused;
+	bool new_period = (next.Period != Period_Sec);
+	bool changed = new_period || (next.Percent != Budget_Percent);
+	dime_set_budget(next.Percent, next.Period);
+	if(new_period)
+	{
+		Pace_Tick = 0;
+		setitimer(ITIMER_VIRTUAL, &Interval, NULL);//the new period starts now
+	}
+	return changed;
+}
+/* ================================================================= */
+/* ------------------------ Shared budget pool --------------------- */
+/*	With -shared_budget 1, the processes of a fork tree draw their budget from one pool,
+	so that N workers together use the budget percentage of one process, not N times it.
+	The pool is a POSIX shared memory segment, /dime_budget_<pid> of the first process. It
+	is inherited by fork(); a process exec'd under Pin (-follow_execv) finds it again by
+	walking up its ancestors in /proc. The first process unlinks the name when it exits
+	(a killed one leaves it in /dev/shm). A process frees its slot before an exec, since
+	the exec'd image keeps the pid and registers again.
+	The pool is refilled with Budget every period of wall-clock time (pool epoch). The
+	budget and period commands of the control channel apply to the pool, so to the whole
+	fork tree. Each
+	process draws batches from it when its local budget runs out, up to a fair share
+	(Budget / registered processes) per epoch. A process frees its slot at exit; the slots
+	of processes that died without exiting (gone or zombie) are freed at the next epoch.
+*/
+#define DIME_POOL_MAX_PROCS 256
+#define DIME_POOL_BATCHES 4 //a process draws its share in this many batches
+#define DIME_POOL_RETRY 4096 //budget checks between two draws when the pool is dry
+struct DimePoolSlot
+{
+	volatile INT32 Pid;//0: free slot
+	volatile INT64 Epoch;//epoch of Drawn
+	volatile INT64 Drawn;//budget drawn in Epoch, in nanoseconds
+};
+struct DimePool
+{
+	volatile INT64 Epoch;//current epoch: wall-clock time / Period_Ns
+	volatile INT64 Left;//budget left in the epoch, in nanoseconds
+	volatile INT64 Total;//budget of one epoch, in nanoseconds
+	volatile INT64 Period_Ns;
+	volatile INT32 Active;//registered processes
+	DimePoolSlot Slots[DIME_POOL_MAX_PROCS];
+};
+static DimePool* Pool = NULL;//NULL: each process has its own budget
+static DimePoolSlot* Pool_Slot = NULL;//slot of this process
+static UINT32 Pool_Retry = 0;//countdown before the next draw from a dry pool
+static INT64 Pool_Drawn_Total = 0;//budget drawn by this process, for pintool.log
+static string Pool_Name;//shm name, unlinked at exit by the process it is named after
+/* ----------------------------------------------------------------- */
+static inline INT64 dime_wall_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (INT64)ts.tv_sec * sec_to_nsec + ts.tv_nsec;
+}
+/* ----------------------------------------------------------------- */
+// reads the state and the parent of pid from /proc/<pid>/stat, returns false if pid is gone
+static inline bool dime_proc_stat(INT32 pid, char* state, INT32* ppid)
+{
+	ostringstream path;
+	path << "/proc/" << pid << "/stat";
+	ifstream stat(path.str().c_str());
+	string line;
+	if(!getline(stat, line)) return false;
+	size_t paren = line.rfind(')');//the command name may contain spaces and parentheses
+	if(paren == string::npos) return false;
+	istringstream fields(line.substr(paren + 1));
+	fields >> *state >> *ppid;
+	return !fields.fail();
+}
+/* ----------------------------------------------------------------- */
+// returns false if pid has exited, even if its parent has not reaped it yet (zombie)
+static inline bool dime_pid_alive(INT32 pid)
+{
+	char state;
+	INT32 ppid;
+	if(dime_proc_stat(pid, &state, &ppid))
+	{
+		return (state != 'Z' && state != 'X');
+	}
+	return !(kill(pid, 0) != 0 && errno == ESRCH);//no /proc
+}
+/* ----------------------------------------------------------------- */
+// takes a free slot for this process, returns false if the pool is full
+static inline bool dime_pool_register()
+{
+	INT32 pid = getpid();
+	for(int i = 0; i < DIME_POOL_MAX_PROCS; i++)
+	{
+		if(__sync_bool_compare_and_swap(&Pool->Slots[i].Pid, 0, pid))
+		{
+			Pool_Slot = &Pool->Slots[i];
+			Pool_Slot->Epoch = Pool->Epoch;
+			Pool_Slot->Drawn = 0;
+			__sync_fetch_and_add(&Pool->Active, 1);
+			return true;
+		}
+	}
+	LOG("Dime budget pool is full, process " + decstr(pid) + " uses its own budget\n");
+	return false;
+}
+/* ----------------------------------------------------------------- */
+// frees the slots of the processes that died without exiting (e.g. SIGKILL)
+static inline void dime_pool_reclaim()
+{
+	for(int i = 0; i < DIME_POOL_MAX_PROCS; i++)
+	{
+		INT32 pid = Pool->Slots[i].Pid;
+		if(pid != 0 && !dime_pid_alive(pid) &&
+		   __sync_bool_compare_and_swap(&Pool->Slots[i].Pid, pid, 0))
+		{
+			__sync_fetch_and_sub(&Pool->Active, 1);
+		}
+	}
+}
+/* ----------------------------------------------------------------- */
+// takes a batch of budget from the pool, returns its size (0: none left for this process)
+static INT64 dime_pool_take()
+{
+	if(Pool_Retry > 0)
+	{
+		Pool_Retry--;
+		return 0;
+	}
+	Pool_Retry = DIME_POOL_RETRY;
+	INT64 epoch = Pool->Epoch;
+	INT64 now = dime_wall_ns() / Pool->Period_Ns;
+	if(now > epoch && __sync_bool_compare_and_swap(&Pool->Epoch, epoch, now))
+	{
+		//first process of the new epoch refills the pool
+		Pool->Left = Pool->Total;
+		dime_pool_reclaim();
+		epoch = now;
+	}
+	else
+	{
+		epoch = Pool->Epoch;
+	}
+	if(Pool_Slot->Epoch != epoch)
+	{
+		Pool_Slot->Epoch = epoch;
+		Pool_Slot->Drawn = 0;
+	}
+	INT32 active = Pool->Active;
+	INT64 share = Pool->Total / (active > 0 ? active : 1);
+	INT64 want = share / DIME_POOL_BATCHES;
+	if(want > share - Pool_Slot->Drawn) want = share - Pool_Slot->Drawn;
+	if(want <= 0) return 0;//fair share used
+	INT64 left;
+	INT64 take;
+	do
+	{
+		left = Pool->Left;
+		if(left <= 0) return 0;//pool is dry
+		take = (want < left) ? want : left;
+	} while(!__sync_bool_compare_and_swap(&Pool->Left, left, left - take));
+	Pool_Slot->Drawn += take;
+	Pool_Drawn_Total += take;
+	Pool_Retry = 0;
+	return take;
+}
+/* ----------------------------------------------------------------- */
+// draws a batch of budget from the pool into Budget_Dec, returns 1 if budget was drawn
+static int dime_pool_draw()
+{
+	INT64 take = dime_pool_take();
+	if(take == 0) return 0;
+	Budget_Dec += take;
+	if(Budget_Dec > 0) dime_stretch_begin(dime_rdtsc64());
+	return (Budget_Dec > 0);
+}
+/* ----------------------------------------------------------------- */
+// sets the budget and period of the pool from Budget and Period_Sec (dime_init, and the
+// alarm handler after a control command); a new period starts a new epoch at once
+static inline void dime_pool_configure()
+{
+	INT64 period_ns = (INT64)(Period_Sec * sec_to_nsec);
+	if(period_ns <= 0) period_ns = sec_to_nsec;
+	Pool->Total = Budget;
+	if(period_ns != Pool->Period_Ns)
+	{
+		Pool->Period_Ns = period_ns;
+		Pool->Epoch = dime_wall_ns() / period_ns;
+		Pool->Left = Budget;
+	}
+	else if(Pool->Left > Budget)
+	{
+		Pool->Left = Budget;//lower budget: from this epoch on
+	}
+}
+/* ----------------------------------------------------------------- */
+// shm name of the pool created by process pid
+static inline string dime_pool_name(INT32 pid)
+{
+	ostringstream name;
+	name << "/dime_budget_" << pid;
+	return name.str();
+}
+/* ----------------------------------------------------------------- */
+// joins the pool of the closest ancestor that has one (exec'd under Pin), else creates
+// the pool of this process (dime_init)
+static inline void dime_pool_init()
+{
+	bool created = false;
+	int fd = -1;
+	char state;
+	INT32 ppid;
+	for(INT32 pid = getpid(); pid > 1 && fd < 0; pid = dime_proc_stat(pid, &state, &ppid) ? ppid : 0)
+	{
+		Pool_Name = dime_pool_name(pid);
+		fd = shm_open(Pool_Name.c_str(), O_RDWR, 0600);
+	}
+	if(fd < 0)
+	{
+		Pool_Name = dime_pool_name(getpid());
+		fd = shm_open(Pool_Name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		created = true;
+		if(fd < 0 || ftruncate(fd, sizeof(DimePool)) != 0)
+		{
+			LOG("Dime budget pool failed! ErrNo = " + decstr(errno) + "\n");
+			if(fd >= 0)
+			{
+				close(fd);
+				shm_unlink(Pool_Name.c_str());
+			}
+			return;
+		}
+	}
+	void* mem = mmap(NULL, sizeof(DimePool), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(mem == MAP_FAILED)
+	{
+		LOG("Dime budget pool failed! mmap ErrNo = " + decstr(errno) + "\n");
+		if(created) shm_unlink(Pool_Name.c_str());
+		return;
+	}
+	Pool = static_cast<DimePool*>(mem);
+	if(created)
+	{
+		memset(mem, 0, sizeof(DimePool));
+		dime_pool_configure();
+	}
+	else
+	{
+		LOG("Dime budget pool " + Pool_Name + " joined\n");
+	}
+	if(!dime_pool_register())
+	{
+		Pool = NULL;
+	}
+}
+/* ----------------------------------------------------------------- */
+// frees the slot of this process and gives back its unused budget (exit or exec)
+static inline void dime_pool_leave()
+{
+	if(Pool == NULL) return;
+	if(__sync_bool_compare_and_swap(&Pool_Slot->Pid, (INT32)getpid(), 0))
+	{
+		__sync_fetch_and_sub(&Pool->Active, 1);
+	}
+	//give back the budget drawn but not used
+	if(Budget_Dec > 0 && Pool_Slot->Epoch == Pool->Epoch)
+	{
+		__sync_fetch_and_add(&Pool->Left, Budget_Dec);
+		Budget_Dec = 0;
+	}
+}
+/* ----------------------------------------------------------------- */
+// frees the slot of this process (dime_fini)
+static inline void dime_pool_exit()
+{
+	if(Pool == NULL) return;
+	LOG("#pool drawn = " + decstr(Pool_Drawn_Total) + "ns, processes = " + decstr(Pool->Active) + "\n");
+	dime_pool_leave();
+	if(Pool_Name == dime_pool_name(getpid()))
+	{
+		shm_unlink(Pool_Name.c_str());//the first process: the fork tree is done with the name
+	}
+}
+/* ================================================================= */
+/* ---------------------- Per-thread budget slices ----------------- */
+/*	With -steal 1, the budget of each period (or slot) is split into one slice per thread,
+	so that a busy thread cannot use up the budget of the others. A thread charges its own
+	slice; when the slice runs dry, the thread steals a batch from the slice of another
+	thread that still has a surplus (CAS on the victim slice, no lock). The slices add up
+	to the process budget, so the total stays within Budget. A thread that finds nothing
+	to steal waits DIME_STEAL_RETRY budget checks before it scans again.
+	Only the slices of running threads (Live) get a share: when a thread exits, its slice
+	is marked dead and its budget moves to the slice of a running thread. The grant
+	updates each slice with a CAS, since thieves and charges update it concurrently.
+*/
+#define DIME_STEAL_BATCHES 4 //a steal takes at most 1/4 of a slice share
+#define DIME_STEAL_RETRY 1024 //budget checks between two scans that found nothing
+struct DimeSlice
+{
+	volatile INT64 Left;//budget left, in nanoseconds (the owner subtracts, thieves CAS)
+	volatile INT64 Donated;//budget stolen from this slice by other threads
+	INT64 Stolen;//budget stolen by the owner from other slices
+	UINT32 Retry;//countdown before the next scan
+	UINT32 Failed;//scans that found nothing
+	volatile INT32 Live;//1 from the start to the exit of the thread
+} __attribute__((aligned(64)));//one cache line per thread
+static BOOL Steal_Enabled = false;
+static DimeSlice Slices[PIN_MAX_THREADS];//indexed by thread id
+static INT64 Slice_Share = 0;//budget granted to each slice at the last grant
+/* ----------------------------------------------------------------- */
+static inline INT32 dime_slice_count()
+{
+	return (Num_Threads < PIN_MAX_THREADS) ? Num_Threads : PIN_MAX_THREADS;
+}
+/* ----------------------------------------------------------------- */
+// alarm handler: splits amount between the slices of the running threads
+// carry: keep the unused budget of each slice, up to one share (pacing slots)
+static inline void dime_slices_grant(INT64 amount, bool carry)
+{
+	INT32 n = dime_slice_count();
+	INT32 live = 0;
+	for(INT32 t = 0; t < n; t++)
+	{
+		live += Slices[t].Live;
+	}
+	if(live < 1)
+	{
+		Slices[0].Live = 1;//no thread registered yet: the first one holds the budget
+		live = 1;
+		if(n < 1) n = 1;
+	}
+	Slice_Share = amount / live;
+	for(INT32 t = 0; t < n; t++)
+	{
+		if(!Slices[t].Live) continue;
+		INT64 left, kept;
+		do
+		{
+			left = Slices[t].Left;
+			kept = (carry && left < Slice_Share) ? left : (carry ? Slice_Share : 0);
+		}
+		while(!__sync_bool_compare_and_swap(&Slices[t].Left, left, kept + Slice_Share));
+		Slices[t].Retry = 0;
+	}
+}
+/* ----------------------------------------------------------------- */
+// thread start: the slice of thread_id gets a share from the next grant on
+static inline void dime_slice_start(THREADID thread_id)
+{
+	Slices[thread_id].Live = 1;
+}
+/* ----------------------------------------------------------------- */
+// thread exit: marks the slice of thread_id dead and moves its budget to a running thread
+static inline void dime_slice_exit(THREADID thread_id)
+{
+	Slices[thread_id].Live = 0;
+	INT64 left = __sync_lock_test_and_set(&Slices[thread_id].Left, 0);
+	if(left <= 0) return;//an overshoot stays with the process budget (Budget_Dec)
+	INT32 n = dime_slice_count();
+	for(INT32 k = 1; k < n; k++)
+	{
+		DimeSlice& heir = Slices[(thread_id + k) % n];
+		if(heir.Live)
+		{
+			__sync_fetch_and_add(&heir.Left, left);
+			return;
+		}
+	}
+}
+/* ----------------------------------------------------------------- */
+// charges the slice of the current thread (dime_end_time)
+static inline void dime_slice_charge(INT64 cost)
+{
+	__sync_fetch_and_sub(&Slices[PIN_ThreadId()].Left, cost);
+}
+/* ----------------------------------------------------------------- */
+// steals a batch from another slice into the slice of thread_id, returns 1 if it has budget
+static int dime_slice_steal(THREADID thread_id)
+{
+	DimeSlice& own = Slices[thread_id];
+	if(own.Retry > 0)
+	{
+		own.Retry--;
+		return 0;
+	}
+	INT64 batch = Slice_Share / DIME_STEAL_BATCHES;
+	INT32 n = dime_slice_count();
+	if(batch > 0)
+	{
+		for(INT32 k = 1; k < n; k++)
+		{
+			DimeSlice& victim = Slices[(thread_id + k) % n];
+			if(!victim.Live) continue;
+			INT64 left = victim.Left;
+			while(left > batch)//the victim keeps at least half of its budget
+			{
+				INT64 take = (batch < left / 2) ? batch : left / 2;
+				if(__sync_bool_compare_and_swap(&victim.Left, left, left - take))
+				{
+					__sync_fetch_and_add(&victim.Donated, take);
+					own.Stolen += take;
+					return (__sync_add_and_fetch(&own.Left, take) > 0);
+				}
+				left = victim.Left;
+			}
+		}
+	}
+	own.Failed++;
+	own.Retry = DIME_STEAL_RETRY;
+	return 0;
+}
+/* ----------------------------------------------------------------- */
+// draws a batch from the shared budget pool into the slice of thread_id
+static int dime_slice_draw(THREADID thread_id)
+{
+	INT64 take = dime_pool_take();
+	if(take == 0) return 0;
+	Budget_Dec += take;
+	dime_stretch_begin(dime_rdtsc64());
+	return (__sync_add_and_fetch(&Slices[thread_id].Left, take) > 0);
+}
+/* ----------------------------------------------------------------- */
+// writes the donated and stolen budget of each thread to pintool.log
+static inline void dime_slices_report()
+{
+	if(!Steal_Enabled) return;
+	INT64 donated = 0, stolen = 0;
+	LOG("#steal (thread donated_ns stolen_ns failed_scans)\n");
+	for(INT32 t = 0; t < dime_slice_count(); t++)
+	{
+		LOG(decstr(t) + " " + decstr(Slices[t].Donated) + " " + decstr(Slices[t].Stolen) + " " + decstr(Slices[t].Failed) + "\n");
+		donated += Slices[t].Donated;
+		stolen += Slices[t].Stolen;
+	}
+	LOG("#steal total donated = " + decstr(donated) + "ns stolen = " + decstr(stolen) + "ns\n");
+	LOG("#eof\n");
+}
+/* ----------------------------------------------------------------- */
+// writes the longest instrumented stretch of each period to pintool.log,
+// then their histogram (power-of-2 buckets in microseconds) and percentiles
+static inline void dime_stretch_report()
+{
+    LOG("#stretch (instrumentation time of the most expensive stretch per period, usec) pace = " + decstr(Pace_Slots) + "\n");
+    for (int i = 0; i < Counter; i++){
+        LOG(decstr(Stretch_Array[i]) + "\n");
+    }
+    UINT32 buckets[33] = {0};
+    for (int i = 0; i < Counter; i++){
+        int b = 0;
+        while(b < 32 && (1u << b) < Stretch_Array[i]) b++;
+        buckets[b]++;
+    }
+    LOG("#stretch histogram (usec <= count)\n");
+    for (int b = 0; b < 33; b++){
+        if(buckets[b] > 0) LOG(decstr((UINT64)1 << b) + " " + decstr(buckets[b]) + "\n");
+    }
+    if(Counter > 0)
+    {
+        std::vector<UINT32> sorted(Stretch_Array, Stretch_Array + Counter);
+        std::sort(sorted.begin(), sorted.end());
+        LOG("#stretch p50 = " + decstr(sorted[(Counter - 1) / 2]) + " p99 = " + decstr(sorted[(Counter - 1) * 99 / 100]) +
+            " max = " + decstr(sorted[Counter - 1]) + " usec\n");
+    }
+    LOG("#eof\n");
+}
+/* ----------------------------------------------------------------- */
+/*	Pacing (-pace <S>): instead of granting the whole budget at the period start, which
+	instruments the first Budget nanoseconds of the period in one burst, the period is
+	split into S slots and each slot grants Budget/S. Budget left over from the previous
+	slot is carried, up to one slot, so a slot never runs instrumented for more than two
+	slot budgets in a row. With the shared budget pool, the pool paces the draws instead.
+*/
+// grants the budget of a new slot inside the period
+static inline void dime_pace_slot(UINT64 now)
+{
+	if(Pool != NULL || Paused) return;
+	INT64 carry = (Budget_Dec < Slot_Budget) ? Budget_Dec : Slot_Budget;
+	Budget_Dec = carry + Slot_Budget;
+	if(Steal_Enabled) dime_slices_grant(Slot_Budget, true);
+	if(Budget_Dec > 0) dime_stretch_begin(now);
+}
+/* ----------------------------------------------------------------- */
+//Alarm handler of alarm_reset
+VOID handler_reset(int signum)
+{
+	Alarm_Fired = true;
+	UINT64 now = dime_rdtsc64();
+	if(++Pace_Tick < Pace_Slots)
+	{
+		dime_pace_slot(now);
+		return;
+	}
+	Pace_Tick = 0;
+	//print budget before reset (for testing)
+	dime_record_period(now);
+	if(dime_apply_config() && Pool != NULL)
+	{
+		dime_pool_configure();
+	}
+	//Reset Budget
+    if(Pool != NULL)
+    {
+        Budget_Dec = (Budget_Dec < 0) ? Budget_Dec : 0;//keep the overshoot, the budget comes from the pool
+    }
+    else
+    {
+        Budget_Dec = Paused ? 0 : Slot_Budget;//Slot_Budget == Budget without pacing
+    }
+	if(Steal_Enabled)
+	{
+		dime_slices_grant(Budget_Dec, false);
+	}
+	if(Budget_Dec > 0)
+	{
+		dime_stretch_begin(now);
+	}
+}
+/* ----------------------------------------------------------------- */
+// counts a budget check of thread_id, for dime_estimate()
+static inline void dime_count_check(THREADID thread_id, int active)
+{
+    Checks[thread_id].All++;
+    Checks[thread_id].Active += active;
+}
+/* ----------------------------------------------------------------- */
+// returns 1 if we should switch to heavyweight instrumentation 
+static inline int dime_has_budget(THREADID thread_id)
+{    
+    int active = (Budget_Dec > 0);
+    dime_count_check(thread_id, active);
+    return active;//no branch and no call: Pin inlines it
+}
+/* ----------------------------------------------------------------- */
+// same as dime_has_budget(), drawing from the shared budget pool (-shared_budget)
+static inline int dime_has_budget_pool(THREADID thread_id)
+{
+    int active = (Budget_Dec > 0) || (Pool != NULL && !Paused && dime_pool_draw());//Pool is NULL in a child that found the pool full
+    dime_count_check(thread_id, active);
+    return active;
+}
+/* ----------------------------------------------------------------- */
+// same as dime_has_budget(), with per-thread slices (-steal)
+static inline int dime_has_budget_thread(THREADID thread_id)
+{
+    int active = (Slices[thread_id].Left > 0) ||
+           (!Paused && (dime_slice_steal(thread_id) || (Pool != NULL && dime_slice_draw(thread_id))));
+    dime_count_check(thread_id, active);
+    return active;
+}
+
+/* ----------------------------------------------------------------- */
+/* ================================================================= */
+
+static inline void dime_start_time()
+{
+	rdtsc(Low_S,High_S);
+}
+/* ----------------------------------------------------------------- */
+// charges ticks of rdtsc that ended at end_tsc to the budget, returns the cost in nanoseconds
+// (atomic: the analysis routines of all the threads charge the same budget)
+static inline INT64 dime_charge(UINT64 ticks, UINT64 end_tsc)
+{
+	INT64 cost = ticks*1000/Freq;
+	INT64 left = __sync_sub_and_fetch(&Budget_Dec, cost);
+	__sync_fetch_and_add(&Stretch_Charged_Tsc, ticks);
+	if(Steal_Enabled) dime_slice_charge(cost);
+	if(left <= 0 && Stretch_Start_Tsc != 0)
+	{
+		dime_stretch_end(end_tsc);//end of the instrumented stretch
+	}
+	return cost;
+}
+/* ----------------------------------------------------------------- */
+// returns the cost charged to the budget, in nanoseconds
+static inline INT64 dime_end_time()
+{
+	rdtsc(Low_E,High_E);
+	//Note: we ignore High_E and High_S since Analysis routine can never exceed 3.5 sec
+	return dime_charge((UINT32)(Low_E - Low_S), ((UINT64)High_E << 32) | Low_E);
+}
+/* ----------------------------------------------------------------- */
+// counts one event recorded by the tool, for dime_estimate()
+static inline void dime_count_event(THREADID thread_id)
+{
+	Checks[thread_id].Events++;
+}
+static inline void dime_count_event()
+{
+	dime_count_event(PIN_ThreadId());
+}
+/* ================================================================= */
+/* -------------------------- Outlier sites ------------------------ */
+/*	With -demote <K>, DIME keeps the average cost of each instrumented site (instruction
+	address), measured by dime_end_time_site(). At the first sample of each period, it
+	computes the median of the site averages. A site whose average cost stays above K times
+	the median is demoted for -demote_backoff periods: dime_site_demoted() returns true,
+	and the tool runs a cheaper version of its analysis routine (or nothing). Every
+	demotion is written to pintool.log.
+*/
+class DimeSite
+{
+  public:
+    DimeSite() : Addr(0), Avg_Cost(0), Samples(0), Demoted_Until(0), Demotions(0) {}
+    ADDRINT Addr;//instrumented instruction
+    INT64 Avg_Cost;//moving average (1/8 weight) of the cost, in nanoseconds
+    UINT32 Samples;//samples since the last demotion
+    INT64 Demoted_Until;//period (Period_Seq) at which the site is promoted again
+    UINT32 Demotions;
+};
+static float Demote_Multiple = 0;//-demote, 0: disabled
+static INT32 Demote_Backoff = 4;//-demote_backoff, in periods
+static const UINT32 DIME_SITE_MIN_SAMPLES = 16;//samples before a site can be demoted
+PIN_LOCK Site_Lock;//protects Sites and Site_Map
+std::vector<DimeSite*> Sites;
+std::unordered_map<ADDRINT, DimeSite*> Site_Map;
+static INT64 Site_Median = 0;//median of the site averages, in nanoseconds
+static volatile INT64 Site_Period = -1;//Period_Seq when Site_Median was computed
+/* ----------------------------------------------------------------- */
+// returns the cost record of the site at ins_addr; call it in the instrumentation routine
+// and pass the pointer to the analysis routine (IARG_PTR)
+static inline DimeSite* dime_site(ADDRINT ins_addr)
+{
+	std::unordered_map<ADDRINT, DimeSite*>::iterator it = Site_Map.find(ins_addr);
+	if(it != Site_Map.end())
+	{
+		return it->second;
+	}
+	DimeSite* site = new DimeSite;
+	site->Addr = ins_addr;
+	GetLock(&Site_Lock, PIN_ThreadId()+1);
+	Site_Map[ins_addr] = site;
+	Sites.push_back(site);
+	ReleaseLock(&Site_Lock);
+	return site;
+}
+/* ----------------------------------------------------------------- */
+// returns true if the analysis routine of the site should run its cheap version
+static inline bool dime_site_demoted(DimeSite* site)
+{
+	return site->Demoted_Until > Period_Seq;
+}
+/* ----------------------------------------------------------------- */
+// computes the median of the site averages, once per period
+static inline void dime_site_median()
+{
+	GetLock(&Site_Lock, PIN_ThreadId()+1);
+	if(Site_Period != Period_Seq)
+	{
+		std::vector<INT64> costs;
+		for(size_t i = 0; i < Sites.size(); i++)
+		{
+			if(Sites[i]->Samples >= DIME_SITE_MIN_SAMPLES) costs.push_back(Sites[i]->Avg_Cost);
+		}
+		if(!costs.empty())
+		{
+			std::nth_element(costs.begin(), costs.begin() + costs.size() / 2, costs.end());
+			Site_Median = costs[costs.size() / 2];
+		}
+		Site_Period = Period_Seq;
+	}
+	ReleaseLock(&Site_Lock);
+}
+/* ----------------------------------------------------------------- */
+// adds one cost sample to the site and demotes it if it is an outlier
+static inline void dime_site_sample(DimeSite* site, INT64 cost)
+{
+	if(Site_Period != Period_Seq)
+	{
+		dime_site_median();
+	}
+	site->Avg_Cost += (cost - site->Avg_Cost) / 8;
+	site->Samples++;
+	if(site->Samples >= DIME_SITE_MIN_SAMPLES && Site_Median > 0 && site->Avg_Cost > Demote_Multiple * Site_Median)
+	{
+		site->Demoted_Until = Period_Seq + Demote_Backoff;
+		site->Demotions++;
+		LOG("demoted site 0x" + hexstr(site->Addr) + ": cost " + decstr(site->Avg_Cost) + " ns, median " +
+		    decstr(Site_Median) + " ns, until period " + decstr(site->Demoted_Until) + "\n");
+		site->Samples = 0;//measure again after the back-off
+		site->Avg_Cost = Site_Median;
+	}
+}
+/* ----------------------------------------------------------------- */
+// dime_end_time() that also samples the cost of the site (use it in the full version of the routine)
+static inline void dime_end_time_site(DimeSite* site)
+{
+	INT64 cost = dime_end_time();
+	if(Demote_Multiple > 0)
+	{
+		dime_site_sample(site, cost);
+	}
+}
+/* ================================================================= */
+/* ------------------------- Scoped probes ------------------------- */
+/*	dime_scope charges the budget when it goes out of scope, so an analysis routine with
+	early returns cannot skip the charge, and each thread keeps its own start time (the
+	globals of dime_start_time() are shared by the threads):
+		VOID EmitReturn(THREADID tid, string* str)
+		{
+			dime_scope<> scope;
+			if(...) return;//charged
+			...
+		}
+	With a site, scope.sample(site) also samples its cost for -demote (dime_end_time_site).
+	dime_instrumented wraps an analysis routine into one that runs it inside a dime_scope:
+		INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(DIME_INSTRUMENTED(EmitReturn)), ...);
+	The probe is a template parameter, chosen at compile time:
+		ProbeRdtsc	rdtsc (default), may be reordered with the code around it
+		ProbeRdtscp	lfence + rdtscp: the measured code has completed at both ends
+		ProbeNone	no measure and no charge: the scope compiles to nothing
+	The default probe of dime_scope<> and DIME_INSTRUMENTED is DIME_PROBE, e.g. build the
+	tool with -DDIME_PROBE=ProbeNone for an unbudgeted build.
+*/
+struct ProbeRdtsc
+{
+	static const bool Enabled = true;
+	static inline UINT64 now()
+	{
+		UINT32 low, high;
+		rdtsc(low, high);
+		return ((UINT64)high << 32) | low;
+	}
+};
+struct ProbeRdtscp
+{
+	static const bool Enabled = true;
+	static inline UINT64 now()
+	{
+		UINT32 low, high, aux;
+		__asm__ __volatile__("lfence\n\trdtscp" : "=a" (low), "=d" (high), "=c" (aux) : : "memory");
+		return ((UINT64)high << 32) | low;
+	}
+};
+struct ProbeNone
+{
+	static const bool Enabled = false;
+	static inline UINT64 now() { return 0; }
+};
+#ifndef DIME_PROBE
+#define DIME_PROBE ProbeRdtsc
+#endif
+/* ----------------------------------------------------------------- */
+template <class Probe = DIME_PROBE>
+class dime_scope
+{
+  public:
+    dime_scope() : Start(Probe::now()), Site(NULL) {}
+    ~dime_scope()
+    {
+        if(!Probe::Enabled) return;
+        UINT64 end = Probe::now();
+        INT64 cost = dime_charge(end - Start, end);
+        if(Site != NULL && Demote_Multiple > 0)
+        {
+            dime_site_sample(Site, cost);
+        }
+    }
+    // samples the cost of site when the scope ends (full version of a routine with -demote)
+    void sample(DimeSite* site) { Site = site; }
+  private:
+    dime_scope(const dime_scope&);//not copyable: one charge per scope
+    dime_scope& operator=(const dime_scope&);
+    UINT64 Start;
+    DimeSite* Site;
+};
+/* ----------------------------------------------------------------- */
+// dime_instrumented<decltype(&Fn), &Fn>::Call runs Fn inside a dime_scope
+template <typename Sig, Sig Fn, class Probe = DIME_PROBE>
+struct dime_instrumented;
+template <typename R, typename... Args, R (*Fn)(Args...), class Probe>
+struct dime_instrumented<R (*)(Args...), Fn, Probe>
+{
+    static R Call(Args... args)
+    {
+        dime_scope<Probe> scope;
+        return Fn(args...);
+    }
+};
+#define DIME_INSTRUMENTED(fn) (&dime_instrumented<decltype(&fn), &fn>::Call)
+#define DIME_INSTRUMENTED_PROBE(fn, probe) (&dime_instrumented<decltype(&fn), &fn, probe>::Call)
+/* ================================================================= */
+/* --------------------- Statistical extrapolation ----------------- */
+/*	Each budget check (dime_has_budget) is one event site reached by the application,
+	instrumented or not. In period i, c_i checks were made, a_i of them found budget,
+	and the tool recorded e_i events (dime_count_event) at those a_i sites. The events
+	per instrumented site, R = sum e_i / sum a_i, applied to all the checks, N = sum c_i,
+	estimate the events of a fully instrumented run: R * N. The counts are exact, so when
+	each site records one event (R = 1) the estimate is exact too.
+	The periods are the sampling units of a ratio estimator: the standard error of R is
+	sqrt(sum (e_i - R a_i)^2 / (m (m - 1))) / mean(a_i) over the m periods with a_i > 0,
+	and R * N +- 1.96 SE(R) * N is the 95% confidence interval of the total (with one
+	period only, the Poisson error of sum e_i is used instead). It assumes that the
+	sites reached in the instrumented part of a period record as many events per site
+	as the others.
+	A single count c (e.g. one call edge) is scaled by N / sum a_i; its interval adds
+	the Poisson error of c (1 / sqrt(c)) to the error of R, which assumes that the count
+	is spread over the periods like the events.
+*/
+struct DimeEstimate
+{
+	double Value;//estimated count under full instrumentation
+	double Low;//95% confidence interval
+	double High;
+};
+static double Est_Scale = 1;//estimated total / recorded events
+static double Est_Rel_Err = 0;//relative standard error of the estimated total
+static double Est_Total = 0;
+static UINT64 Est_Recorded = 0;
+/* ----------------------------------------------------------------- */
+// records the last (partial) period and computes the scaling factor; called once
+static inline void dime_close_sampling()
+{
+	if(Sampling_Closed) return;
+	Sampling_Closed = true;
+	dime_record_period(dime_rdtsc64());
+	double checks = 0, active = 0, events = 0;
+	int m = 0;
+	for(int i = 0; i < Counter; i++)
+	{
+		checks += Checks_Array[i];
+		active += Active_Array[i];
+		events += Events_Array[i];
+		if(Active_Array[i] > 0) m++;
+	}
+	Est_Recorded = (UINT64)events;
+	if(active <= 0)
+	{
+		Est_Total = events;//nothing instrumented: nothing to scale
+		return;
+	}
+	double ratio = events / active;
+	Est_Total = ratio * checks;
+	Est_Scale = checks / active;
+	if(m > 1 && ratio > 0)
+	{
+		double sq = 0;
+		for(int i = 0; i < Counter; i++)
+		{
+			if(Active_Array[i] == 0) continue;
+			double d = Events_Array[i] - ratio * Active_Array[i];
+			sq += d * d;
+		}
+		double se = sqrt(sq / ((double)m * (m - 1))) / (active / m);
+		Est_Rel_Err = se / ratio;
+	}
+	else if(events > 0)
+	{
+		Est_Rel_Err = 1.0 / sqrt(events);
+	}
+}
+/* ----------------------------------------------------------------- */
+// estimated full-instrumentation value of a count recorded under DIME
+static inline DimeEstimate dime_estimate(UINT64 observed)
+{
+	dime_close_sampling();
+	DimeEstimate est;
+	est.Value = observed * Est_Scale;
+	double rel = 1.96 * sqrt(Est_Rel_Err * Est_Rel_Err + (observed > 0 ? 1.0 / observed : 0));
+	est.Low = est.Value * (1 - rel);
+	if(est.Low < observed)
+	{
+		est.Low = observed;//at least what was recorded
+	}
+	est.High = est.Value * (1 + rel);
+	return est;
+}
+/* ----------------------------------------------------------------- */
+/* Dedupe filter for the analysis routines */
+// mixes the bits of key (64-bit finalizer of MurmurHash3)
+static inline UINT64 dime_mix(UINT64 key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return key;
+}
+/* ----------------------------------------------------------------- */
+// combines two values (e.g. call site and target) into one dime_seen() key
+static inline UINT64 dime_key(UINT64 a, UINT64 b)
+{
+	return dime_mix(a) ^ b;
+}
+/* ----------------------------------------------------------------- */
+// returns true if key was already seen by this thread, otherwise remembers it and returns false
+// The set is a per-thread direct-mapped cache of hashed keys: no locks, one load and compare.
+// It is approximate: a key evicted by another key with the same index is reported as new again.
+static inline bool dime_seen(THREADID thread_id, UINT64 key)
+{
+	UINT64 tag = dime_mix(key) | 1;//never 0, 0 marks an empty entry
+	UINT64* entry = &get_tls(thread_id)->Seen[(tag >> 1) & (DIME_SEEN_SIZE - 1)];
+	if(*entry == tag)
+	{
+		return true;
+	}
+	*entry = tag;
+	return false;
+}
+/* ================================================================= */
+/* ----------------------- Per-thread output ----------------------- */
+/*	Each record is one line: 16 hex digits of rdtsc, a space, the formatted text.
+	Newlines inside the text are replaced by spaces, so that a record is always one line.
+	The time stamps are comparable between threads if the cpu has an invariant tsc
+	(constant_tsc and nonstop_tsc in /proc/cpuinfo).
+*/
+/* ----------------------------------------------------------------- */
+// writes the buffered records of the shard to its file
+static inline void dime_shard_flush(DimeShard* shard)
+{
+	UINT32 done = 0;
+	while(done < shard->Pos)
+	{
+		ssize_t n = write(shard->Fd, shard->Buf + done, shard->Pos - done);
+		if(n <= 0) break;
+		done += n;
+	}
+	shard->Pos = 0;
+}
+/* ----------------------------------------------------------------- */
+// opens the output shard of the thread: base_name.<thread_id + 1>
+static inline void dime_shard_open(THREADID thread_id, const char* base_name)
+{
+	DimeShard* shard = &get_tls(thread_id)->Shard;
+	ostringstream ss;
+	ss << base_name << "." << (thread_id + 1);
+	shard->Fd = open(ss.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(shard->Fd < 0)
+	{
+		LOG("Cannot open shard " + ss.str() + "\n");
+		return;
+	}
+	shard->Buf = new char[DIME_SHARD_BUF_SIZE];
+	shard->Pos = 0;
+}
+/* ----------------------------------------------------------------- */
+// writes one time-stamped record to the shard of the thread (printf format)
+static inline void dime_shard_printf(THREADID thread_id, const char* format, ...)
+{
+	DimeShard* shard = &get_tls(thread_id)->Shard;
+	if(shard->Fd < 0) return;
+	if(shard->Pos + DIME_SHARD_RECORD_MAX > DIME_SHARD_BUF_SIZE)
+	{
+		dime_shard_flush(shard);
+	}
+	char* rec = shard->Buf + shard->Pos;
+	snprintf(rec, 18, "%016llx ", (unsigned long long)dime_rdtsc64());
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(rec + 17, DIME_SHARD_RECORD_MAX - 18, format, args);
+	va_end(args);
+	if(len < 0) len = 0;
+	if(len > DIME_SHARD_RECORD_MAX - 19) len = DIME_SHARD_RECORD_MAX - 19;//truncated
+	for(int i = 0; i < len; i++)
+	{
+		if(rec[17 + i] == '\n') rec[17 + i] = ' ';
+	}
+	rec[17 + len] = '\n';
+	shard->Pos += 18 + len;
+}
+/* ----------------------------------------------------------------- */
+static inline void dime_shard_close(THREADID thread_id)
+{
+	ThreadData* tdata = get_tls(thread_id);
+	if(tdata == NULL || tdata->Shard.Fd < 0) return;
+	dime_shard_flush(&tdata->Shard);
+	close(tdata->Shard.Fd);
+	tdata->Shard.Fd = -1;
+	delete[] tdata->Shard.Buf;
+	tdata->Shard.Buf = NULL;
+}
+/* ----------------------------------------------------------------- */
+static inline bool dime_compare_to_log(THREADID thread_id, UINT64 trace_rel_addr, USIZE trace_size, char* img_name)
+{
+	bool ret_val = 0;
+	if(Redun_Suppress)
+	{
+	    std::unordered_map<UINT64,USIZE>::iterator Iterator;
+	    LogData* ldata = get_logdata(thread_id, img_name);
+	    GetLock(&Log_Lock, thread_id+1);
+	    if(ldata->Log.empty())
+	    {
+		    ret_val = 1;
+	    }
+	    else
+	    {
+		    ldata->Total_Test++;
+		    Iterator = ldata->Log.find(trace_rel_addr);
+		    //avg. case: constant, worst case: linear
+		    //check keys only (range checking is not possible)
+		    if(Iterator == ldata->Log.end())//not found
+		    {
+			    ret_val = 1;
+		    }
+		    else
+		    {
+			    //found as key
+			    ret_val = 0;
+		    }
+	    }
+	    ReleaseLock(&Log_Lock);
+	}
+	return ret_val;
+}
+/* ----------------------------------------------------------------- */
+static inline void dime_modify_log(ADDRINT version, THREADID thread_id, UINT64 trace_rel_addr, USIZE trace_size, char* img_name)
+{
+    if(Redun_Suppress)
+	{
+	    LogData* ldata = get_logdata(thread_id, img_name);
+	    LogDelta delta;
+	    delta.Trace = trace_rel_addr;
+	    if(version == VERSION_BASE && trace_rel_addr == ldata->Previous_Trace)
+	    {
+		    //handle the case in which: the trace initialy has version 1, 
+		    //then Pin checks budget, accordingly the trace switches to version 0
+		    //therefore, remove this trace from the log
+		    GetLock(&Log_Lock, thread_id+1);
+		    size_t erased = ldata->Log.erase(trace_rel_addr);
+		    delta.Size = 0;
+		    if(erased == 1) ldata->Pending.push_back(delta);
+		    ReleaseLock(&Log_Lock);
+		    if(erased != 1)
+		    {
+			    ostringstream ss;
+			    ss <<  "Error " << trace_rel_addr;
+			    ldata->Errors += ss.str();
+			    ldata->Errors += " not erased\n";
+		    }
+		    ldata->Previous_Trace = 0;
+		    ldata->Previous_Size = 0;
+	    }
+	    else if(version == VERSION_INSTRUMENT)//record instrumented trace
+	    {
+		    GetLock(&Log_Lock, thread_id+1);
+		    ldata->Log[trace_rel_addr] = trace_size;
+		    //avg. case: constant, worst case: linear
+		    delta.Size = trace_size;
+		    ldata->Pending.push_back(delta);
+		    ReleaseLock(&Log_Lock);
+		    ldata->Previous_Trace = trace_rel_addr;
+		    ldata->Previous_Size = trace_size;
+	    }
+	}
+}
+/* ================================================================= */
+/* ------------------------- Checkpointing ------------------------- */
+/*	The changes of each log are appended to its log file (Pending -> file) by the
+	checkpointer thread every -ckpt seconds and by dime_fini(), so a killed run keeps
+	its log up to the last checkpoint. When the file holds many more lines than the
+	log has entries, it is compacted: the whole log is written to a temporary file
+	that is renamed over the log file (rename() is atomic).
+*/
+/* ----------------------------------------------------------------- */
+// writes all of lines to the file, returns false on error
+static inline bool dime_write_all(int fd, const string& lines)
+{
+	size_t done = 0;
+	while(done < lines.size())
+	{
+		ssize_t n = write(fd, lines.data() + done, lines.size() - done);
+		if(n <= 0) return false;
+		done += n;
+	}
+	return true;
+}
+/* ----------------------------------------------------------------- */
+// rewrites the log file from the log entries (temporary file + rename)
+static inline void dime_compact_log(LogData* ldata, const string& file, THREADID owner)
+{
+	ostringstream ss;
+	ss << get_log_header() << "\n";
+	GetLock(&Log_Lock, owner+1);
+	for(auto it = ldata->Log.begin(); it != ldata->Log.end(); ++it)
+	{
+		ss << it->first << " " << it->second << "\n";
+	}
+	UINT64 lines = ldata->Log.size();
+	ldata->Pending.clear();//included in the snapshot
+	ReleaseLock(&Log_Lock);
+	string tmp = file + ".tmp";
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) return;
+	bool ok = dime_write_all(fd, ss.str()) && fsync(fd) == 0;
+	close(fd);
+	if(ok && rename(tmp.c_str(), file.c_str()) == 0)
+	{
+		ldata->Deltas_Written = lines;
+		ldata->File_Started = true;
+		ldata->Has_Header = true;
+	}
+}
+/* ----------------------------------------------------------------- */
+// appends the pending changes of one log to its file
+static inline void dime_checkpoint_log(LogData* ldata, const string& file, THREADID owner)
+{
+	std::vector<LogDelta> deltas;
+	GetLock(&Log_Lock, owner+1);
+	deltas.swap(ldata->Pending);
+	UINT64 entries = ldata->Log.size();
+	ReleaseLock(&Log_Lock);
+	if(deltas.empty()) return;
+	if(ldata->Deltas_Written + deltas.size() > 2 * entries + 1024)
+	{
+		dime_compact_log(ldata, file, owner);
+		return;
+	}
+	ostringstream ss;
+	//the first run starts a new file, the next runs add to the file they read
+	bool append = ldata->File_Started || (Run_Num > 1 && !ldata->Discard_File);
+	if(!append || !ldata->Has_Header)
+	{
+		ss << get_log_header() << "\n";
+	}
+	for(size_t i = 0; i < deltas.size(); i++)
+	{
+		if(deltas[i].Size == 0)
+			ss << "- " << deltas[i].Trace << "\n";
+		else
+			ss << deltas[i].Trace << " " << deltas[i].Size << "\n";
+	}
+	int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+	int fd = open(file.c_str(), flags, 0644);
+	if(fd < 0) return;
+	dime_write_all(fd, ss.str());
+	close(fd);
+	ldata->File_Started = true;
+	ldata->Has_Header = true;
+	ldata->Deltas_Written += deltas.size();
+}
+/* ----------------------------------------------------------------- */
+// fork child, once Log_Tag is set: the entries inherited from the parent are in the
+// parent's files, so the child starts its own files with its own changes only, and
+// in the next runs reads them back for the images the parent had loaded
+static inline void dime_logs_fork_child()
+{
+	InitLock(&Log_Lock);//may have been held by another thread of the parent
+	InitLock(&Ckpt_Lock);
+	for(int t = 0; t < Num_Threads; t++)
+	{
+		ThreadData* tdata = get_tls(t);
+		if(tdata == NULL) continue;
+		for(auto it = tdata->Img_Logs.begin(); it != tdata->Img_Logs.end(); ++it)
+		{
+			LogData& ldata = it->second;
+			ldata.Pending.clear();
+			ldata.Deltas_Written = 0;
+			ldata.File_Started = false;
+			ldata.Has_Header = false;
+			ldata.Discard_File = false;
+			if(Run_Num > 1)
+			{
+				read_log(get_log_file_name(t, it->first), t, it->first);
+			}
+		}
+	}
+}
+/* ----------------------------------------------------------------- */
+// appends the changes of all logs (each thread, each image) to the log files
+static inline void dime_checkpoint()
+{
+	THREADID owner = PIN_ThreadId();
+	GetLock(&Ckpt_Lock, owner+1);
+	for(int t = 0; t < Num_Threads; t++)
+	{
+		ThreadData* tdata = get_tls(t);
+		if(tdata == NULL) continue;//thread is starting
+		std::vector<std::pair<char*, LogData*> > logs;
+		GetLock(&Log_Lock, owner+1);
+		for(auto it = tdata->Img_Logs.begin(); it != tdata->Img_Logs.end(); ++it)
+		{
+			logs.push_back(std::make_pair(it->first, &it->second));
+		}
+		ReleaseLock(&Log_Lock);
+		for(size_t i = 0; i < logs.size(); i++)
+		{
+			dime_checkpoint_log(logs[i].second, get_log_file_name(t, logs[i].first), owner);
+		}
+	}
+	ReleaseLock(&Ckpt_Lock);
+}
@@ -0,0 +1,152 @@
+/*
+	DIME platform layer: the part of the Pin API that dime_core.h uses.
+
+	Pin backend (default): pin.H itself.
+	Stub backend (#define DIME_PLATFORM_STUB before including dime_core.h): the same
+	names implemented with pthreads and stderr, so that the core builds and runs on any
+	Linux box without a Pin kit (benchmarks, tests). The stub has no instrumentation:
+	the code under test calls the analysis-side functions of the core directly.
+
+	Used by the core:
+	- types: UINT8..UINT64, INT32, INT64, ADDRINT, USIZE, BOOL, VOID, THREADID, TLS_KEY
+	- locks: PIN_LOCK, InitLock(), GetLock(), ReleaseLock()
+	- threads: PIN_ThreadId(), PIN_MAX_THREADS, INVALID_THREADID, PIN_CreateThreadDataKey(),
+	  PIN_GetThreadData(), PIN_SetThreadData()
+	- log: LOG(), decstr(), hexstr(), fltstr()
+*/
+
+#ifndef DIME_PLATFORM_STUB
+
+#include "pin.H"
+
+#else
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <string>
+#include <sstream>
+#include <iomanip>
+
+using namespace std;
+
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef int32_t INT32;
+typedef int64_t INT64;
+typedef uintptr_t ADDRINT;
+typedef size_t USIZE;
+typedef bool BOOL;
+typedef void VOID;
+typedef UINT32 THREADID;
+typedef INT32 TLS_KEY;
+
+#define PIN_MAX_THREADS 2048
+#define DIME_STUB_MAX_KEYS 8
+
+/* ----------------------------------------------------------------- */
+// PIN_LOCK: the owner argument of GetLock() is only used by Pin for debugging
+struct PIN_LOCK
+{
+	pthread_mutex_t Mutex;
+};
+static inline VOID InitLock(PIN_LOCK* lock)
+{
+	pthread_mutex_init(&lock->Mutex, NULL);
+}
+static inline VOID GetLock(PIN_LOCK* lock, INT32 owner)
+{
+	pthread_mutex_lock(&lock->Mutex);
+}
+static inline VOID ReleaseLock(PIN_LOCK* lock)
+{
+	pthread_mutex_unlock(&lock->Mutex);
+}
+/* ----------------------------------------------------------------- */
+// thread ids: 0, 1, 2... in the order in which the threads first ask for theirs. The id of
+// a thread that exits goes to the next new thread (pthread key destructor), so the ids stay
+// below the number of threads running at once; past PIN_MAX_THREADS, INVALID_THREADID
+#define INVALID_THREADID ((THREADID)-1)
+static pthread_mutex_t Stub_Id_Mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t Stub_Id_Once = PTHREAD_ONCE_INIT;
+static pthread_key_t Stub_Id_Key;
+static UINT32 Stub_Next_Thread = 0;//ids never given so far start here
+static UINT32 Stub_Free_Ids[PIN_MAX_THREADS];//ids of the threads that exited
+static UINT32 Stub_Free_Count = 0;
+static __thread UINT32 Stub_Thread_Id = 0;//id + 1, 0: not assigned yet
+static VOID stub_release_id(VOID* id)
+{
+	pthread_mutex_lock(&Stub_Id_Mutex);
+	Stub_Free_Ids[Stub_Free_Count++] = (UINT32)(uintptr_t)id - 1;
+	pthread_mutex_unlock(&Stub_Id_Mutex);
+	Stub_Thread_Id = 0;
+}
+static VOID stub_create_id_key()
+{
+	pthread_key_create(&Stub_Id_Key, stub_release_id);
+}
+static inline THREADID PIN_ThreadId()
+{
+	if(Stub_Thread_Id == 0)
+	{
+		pthread_once(&Stub_Id_Once, stub_create_id_key);
+		pthread_mutex_lock(&Stub_Id_Mutex);
+		UINT32 id = INVALID_THREADID;
+		if(Stub_Free_Count > 0) id = Stub_Free_Ids[--Stub_Free_Count];
+		else if(Stub_Next_Thread < PIN_MAX_THREADS) id = Stub_Next_Thread++;
+		pthread_mutex_unlock(&Stub_Id_Mutex);
+		if(id == INVALID_THREADID) return INVALID_THREADID;//asks again at the next call
+		Stub_Thread_Id = id + 1;
+		pthread_setspecific(Stub_Id_Key, (VOID*)(uintptr_t)Stub_Thread_Id);
+	}
+	return Stub_Thread_Id - 1;
+}
+/* ----------------------------------------------------------------- */
+// thread data: one slot per key and thread id, like Pin
+static VOID* Stub_Thread_Data[DIME_STUB_MAX_KEYS][PIN_MAX_THREADS];
+static volatile INT32 Stub_Next_Key = 0;
+static inline TLS_KEY PIN_CreateThreadDataKey(VOID (*destruct)(VOID*))
+{
+	return __sync_fetch_and_add(&Stub_Next_Key, 1);
+}
+static inline VOID* PIN_GetThreadData(TLS_KEY key, THREADID thread_id)
+{
+	if(key < 0 || key >= DIME_STUB_MAX_KEYS || thread_id >= PIN_MAX_THREADS) return NULL;
+	return Stub_Thread_Data[key][thread_id];
+}
+static inline BOOL PIN_SetThreadData(TLS_KEY key, const VOID* data, THREADID thread_id)
+{
+	if(key < 0 || key >= DIME_STUB_MAX_KEYS || thread_id >= PIN_MAX_THREADS) return false;
+	Stub_Thread_Data[key][thread_id] = const_cast<VOID*>(data);
+	return true;
+}
+/* ----------------------------------------------------------------- */
+// LOG writes to Stub_Log_File (stderr if NULL), or nowhere if Stub_Log_Quiet is set (benchmarks)
+static BOOL Stub_Log_Quiet = false;
+static FILE* Stub_Log_File = NULL;
+static inline VOID LOG(const string& message)
+{
+	if(!Stub_Log_Quiet) fputs(message.c_str(), Stub_Log_File ? Stub_Log_File : stderr);
+}
+template <class T> static inline string decstr(T value)
+{
+	ostringstream ss;
+	ss << value;
+	return ss.str();
+}
+static inline string hexstr(UINT64 value)
+{
+	ostringstream ss;
+	ss << std::hex << value;
+	return ss.str();
+}
+static inline string fltstr(double value, UINT32 precision = 2)
+{
+	ostringstream ss;
+	ss << std::fixed << std::setprecision(precision) << value;
+	return ss.str();
+}
+
+#endif
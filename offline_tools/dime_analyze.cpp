@@ -0,0 +1,471 @@
+/*
+	Parallel analyzer of the outputs of the DIME tools.
+
+	Each trace file is mapped in memory (mmap) and split into chunks at line boundaries;
+	a pool of threads parses the chunks into per-thread tables, which are merged at the end.
+	The log files are parsed in parallel too, one file per task.
+
+	Inputs:
+	  -c file   call trace (call_dime.out, call.out, or a merged shard file): "C caller callee",
+	            "T caller callee", "R function"; a 16-hex-digit time stamp prefix is skipped
+	  -b file   branch trace (branch_dime.out, branch.out): one line per taken branch
+	  -l dir    directory of redundancy logs (log_<thread>_<image>.out) after one run;
+	            give one -l per run, in run order, for the coverage of each run
+	  -p file   pintool.log of a DIME run: Budget_Array statistics
+	  -j N      threads (default: all cores)
+	  -n N      number of call edges and branch sites in the top lists (default 20)
+	Each option can be repeated. The report goes to stdout, the parse throughput to stderr.
+
+	To compile:  g++ -O2 -std=c++11 -pthread -o dime_analyze dime_analyze.cpp
+	To run:      dime_analyze -c call_dime.out -l run1 -l run2 -p pintool.log
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <iostream>
+
+using namespace std;
+
+typedef unsigned long long u64;
+
+/* ----------------------------------------------------------------- */
+// a piece of a mapped file: the keys of the tables point into the mappings
+struct Span
+{
+	const char* P;
+	size_t N;
+	bool operator==(const Span& other) const
+	{
+		return N == other.N && memcmp(P, other.P, N) == 0;
+	}
+	string str() const { return string(P, N); }
+};
+struct SpanHash
+{
+	size_t operator()(const Span& s) const
+	{
+		u64 h = 1469598103934665603ULL;//FNV-1a
+		for(size_t i = 0; i < s.N; i++)
+		{
+			h = (h ^ (unsigned char)s.P[i]) * 1099511628211ULL;
+		}
+		return h;
+	}
+};
+typedef unordered_map<Span, u64, SpanHash> Counts;
+
+/* ----------------------------------------------------------------- */
+static double now_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ----------------------------------------------------------------- */
+// runs task(0) ... task(count - 1) on threads threads
+template <class Task> static void run_pool(size_t count, unsigned threads, Task task)
+{
+	atomic<size_t> next(0);
+	vector<thread> pool;
+	for(unsigned t = 0; t < threads; t++)
+	{
+		pool.push_back(thread([&, t]() {
+			for(size_t i = next++; i < count; i = next++) task(t, i);
+		}));
+	}
+	for(size_t t = 0; t < pool.size(); t++) pool[t].join();
+}
+
+/* ----------------------------------------------------------------- */
+struct MappedFile
+{
+	const char* Data;
+	size_t Size;
+};
+// maps a file read-only, exits on error (the mapping lives until the end of the run)
+static MappedFile map_file(const char* path)
+{
+	MappedFile f = { NULL, 0 };
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) != 0)
+	{
+		cerr << "Cannot open " << path << endl;
+		exit(1);
+	}
+	f.Size = st.st_size;
+	if(f.Size > 0)
+	{
+		void* mem = mmap(NULL, f.Size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(mem == MAP_FAILED)
+		{
+			cerr << "Cannot map " << path << endl;
+			exit(1);
+		}
+		madvise(mem, f.Size, MADV_SEQUENTIAL);
+		f.Data = static_cast<const char*>(mem);
+	}
+	close(fd);
+	return f;
+}
+
+/* ----------------------------------------------------------------- */
+// splits a file into about n chunks that end at a line boundary
+static vector<Span> split_chunks(const MappedFile& f, size_t n)
+{
+	vector<Span> chunks;
+	size_t start = 0;
+	size_t step = f.Size / n + 1;
+	while(start < f.Size)
+	{
+		size_t end = min(f.Size, start + step);
+		const char* nl = (end < f.Size) ? static_cast<const char*>(memchr(f.Data + end, '\n', f.Size - end)) : NULL;
+		end = (nl != NULL) ? (nl - f.Data) + 1 : f.Size;
+		Span c = { f.Data + start, end - start };
+		chunks.push_back(c);
+		start = end;
+	}
+	return chunks;
+}
+
+/* ----------------------------------------------------------------- */
+// calls line(record) for each line of the chunk; with stamped (traces), skips the time
+// stamp of the shards, which a log key of 16 digits would look like
+template <class Line> static void for_each_record(const Span& chunk, bool stamped, Line line)
+{
+	const char* p = chunk.P;
+	const char* end = chunk.P + chunk.N;
+	while(p < end)
+	{
+		const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+		const char* e = (nl != NULL) ? nl : end;
+		Span r = { p, (size_t)(e - p) };
+		if(stamped && r.N > 17 && r.P[16] == ' ' && strspn(r.P, "0123456789abcdef") == 16)
+		{
+			r.P += 17;
+			r.N -= 17;
+		}
+		if(r.N > 0 && r.P[0] != '#') line(r);
+		p = e + 1;
+	}
+}
+
+/* ================================================================= */
+/* ------------------------------ Calls ---------------------------- */
+struct CallTables
+{
+	Counts Edges;//whole record: kind caller callee
+	Counts Calls;//callee of C and T records
+	Counts Returns;//function of R records
+	u64 Records;
+	CallTables() : Records(0) {}
+};
+
+// "C caller callee": the callee starts after the second space (demoted sites have two)
+static void parse_call(const Span& r, CallTables* t)
+{
+	t->Records++;
+	const char* sp = static_cast<const char*>(memchr(r.P, ' ', r.N));
+	if(sp == NULL) return;
+	const char* end = r.P + r.N;
+	if(r.P[0] == 'R')
+	{
+		Span fn = { sp + 1, (size_t)(end - sp - 1) };
+		t->Returns[fn]++;
+		return;
+	}
+	t->Edges[r]++;
+	const char* sp2 = static_cast<const char*>(memchr(sp + 1, ' ', end - sp - 1));
+	if(sp2 == NULL) return;
+	while(sp2 < end && *sp2 == ' ') sp2++;
+	Span callee = { sp2, (size_t)(end - sp2) };
+	t->Calls[callee]++;
+}
+
+static void merge_counts(Counts* into, const Counts& from)
+{
+	for(Counts::const_iterator it = from.begin(); it != from.end(); ++it)
+	{
+		(*into)[it->first] += it->second;
+	}
+}
+
+static vector<pair<u64, Span> > sorted_counts(const Counts& counts)
+{
+	vector<pair<u64, Span> > v;
+	v.reserve(counts.size());
+	for(Counts::const_iterator it = counts.begin(); it != counts.end(); ++it)
+	{
+		v.push_back(make_pair(it->second, it->first));
+	}
+	sort(v.begin(), v.end(), [](const pair<u64, Span>& a, const pair<u64, Span>& b) {
+		return a.first > b.first || (a.first == b.first && a.second.str() < b.second.str());
+	});
+	return v;
+}
+
+/* ----------------------------------------------------------------- */
+// parses the chunks of all files with the pool; Parse(record, table of the thread)
+template <class Table, class Parse>
+static vector<Table> parse_files(const vector<string>& files, unsigned threads, const char* what, Parse parse)
+{
+	vector<Table> tables(threads);
+	vector<Span> chunks;
+	size_t bytes = 0;
+	for(size_t i = 0; i < files.size(); i++)
+	{
+		MappedFile f = map_file(files[i].c_str());
+		vector<Span> c = split_chunks(f, threads * 8);
+		chunks.insert(chunks.end(), c.begin(), c.end());
+		bytes += f.Size;
+	}
+	double start = now_sec();
+	run_pool(chunks.size(), threads, [&](unsigned t, size_t i) {
+		Table* table = &tables[t];
+		for_each_record(chunks[i], true, [&](const Span& r) { parse(r, table); });
+	});
+	double sec = now_sec() - start;
+	fprintf(stderr, "%s: %.1f MB parsed in %.3f s (%.1f MB/s, %u threads)\n", what, bytes / 1e6, sec,
+	        sec > 0 ? bytes / 1e6 / sec : 0.0, threads);
+	return tables;
+}
+
+static void report_calls(const vector<string>& files, unsigned threads, size_t top)
+{
+	vector<CallTables> tables = parse_files<CallTables>(files, threads, "calls", parse_call);
+	CallTables all;
+	for(size_t t = 0; t < tables.size(); t++)
+	{
+		merge_counts(&all.Edges, tables[t].Edges);
+		merge_counts(&all.Calls, tables[t].Calls);
+		merge_counts(&all.Returns, tables[t].Returns);
+		all.Records += tables[t].Records;
+	}
+	printf("# calls: %llu records, %zu edges, %zu functions\n", all.Records, all.Edges.size(), all.Calls.size());
+	printf("# top call edges (count kind caller callee)\n");
+	vector<pair<u64, Span> > edges = sorted_counts(all.Edges);
+	for(size_t i = 0; i < edges.size() && i < top; i++)
+	{
+		printf("%llu %s\n", edges[i].first, edges[i].second.str().c_str());
+	}
+	printf("# function calls (calls returns function)\n");
+	vector<pair<u64, Span> > calls = sorted_counts(all.Calls);
+	for(size_t i = 0; i < calls.size(); i++)
+	{
+		Counts::const_iterator r = all.Returns.find(calls[i].second);
+		printf("%llu %llu %s\n", calls[i].first, r != all.Returns.end() ? r->second : 0ULL, calls[i].second.str().c_str());
+	}
+	printf("# eof\n");
+}
+
+/* ================================================================= */
+/* ----------------------------- Branches -------------------------- */
+struct BranchTables
+{
+	Counts Sites;//disassembly of the branch, or its address for a demoted site
+	u64 Records;
+	BranchTables() : Records(0) {}
+};
+
+static void report_branches(const vector<string>& files, unsigned threads, size_t top)
+{
+	vector<BranchTables> tables = parse_files<BranchTables>(files, threads, "branches",
+		[](const Span& r, BranchTables* t) { t->Records++; t->Sites[r]++; });
+	BranchTables all;
+	for(size_t t = 0; t < tables.size(); t++)
+	{
+		merge_counts(&all.Sites, tables[t].Sites);
+		all.Records += tables[t].Records;
+	}
+	printf("# branches: %llu taken, %zu sites\n", all.Records, all.Sites.size());
+	printf("# top branch sites (count fraction site)\n");
+	vector<pair<u64, Span> > sites = sorted_counts(all.Sites);
+	for(size_t i = 0; i < sites.size() && i < top; i++)
+	{
+		printf("%llu %.4f %s\n", sites[i].first, all.Records > 0 ? (double)sites[i].first / all.Records : 0.0,
+		       sites[i].second.str().c_str());
+	}
+	printf("# eof\n");
+}
+
+/* ================================================================= */
+/* ------------------------------ Logs ----------------------------- */
+struct LogFile
+{
+	size_t Run;//index of the -l directory
+	string Image;
+	string Path;
+	unordered_map<u64, u64> Traces;//trace key -> trace size, after replaying the file
+};
+
+// replays a log file: "key size" adds a trace, "- key" erases it, '#' lines are headers
+static void parse_log(LogFile* log)
+{
+	MappedFile f = map_file(log->Path.c_str());
+	Span all = { f.Data, f.Size };
+	for_each_record(all, false, [&](const Span& r) {
+		string line = r.str();
+		if(line[0] == '-')
+		{
+			log->Traces.erase(strtoull(line.c_str() + 1, NULL, 10));
+			return;
+		}
+		char* end;
+		u64 key = strtoull(line.c_str(), &end, 10);
+		if(end == line.c_str()) return;
+		log->Traces[key] = strtoull(end, NULL, 10);
+	});
+	if(f.Size > 0) munmap(const_cast<char*>(f.Data), f.Size);
+}
+
+static void report_logs(const vector<string>& dirs, unsigned threads)
+{
+	vector<LogFile> logs;
+	for(size_t run = 0; run < dirs.size(); run++)
+	{
+		DIR* d = opendir(dirs[run].c_str());
+		if(d == NULL)
+		{
+			cerr << "Cannot open " << dirs[run] << endl;
+			exit(1);
+		}
+		while(struct dirent* e = readdir(d))
+		{
+			//log_<thread>_<image>.out
+			string name = e->d_name;
+			if(name.compare(0, 4, "log_") != 0 || name.size() < 9 || name.compare(name.size() - 4, 4, ".out") != 0) continue;
+			size_t sep = name.find('_', 4);
+			if(sep == string::npos) continue;
+			LogFile log;
+			log.Run = run;
+			log.Image = name.substr(sep + 1, name.size() - 4 - sep - 1);
+			log.Path = dirs[run] + "/" + name;
+			logs.push_back(log);
+		}
+		closedir(d);
+	}
+	double start = now_sec();
+	run_pool(logs.size(), threads, [&](unsigned t, size_t i) { parse_log(&logs[i]); });
+	fprintf(stderr, "logs: %zu files parsed in %.3f s\n", logs.size(), now_sec() - start);
+	//per run and image: traces of all threads (a trace is counted once)
+	typedef pair<size_t, string> RunImage;
+	std::map<RunImage, unordered_map<u64, u64> > coverage;
+	for(size_t i = 0; i < logs.size(); i++)
+	{
+		unordered_map<u64, u64>& traces = coverage[RunImage(logs[i].Run, logs[i].Image)];
+		traces.insert(logs[i].Traces.begin(), logs[i].Traces.end());
+	}
+	printf("# coverage (run image traces bytes new_traces)\n");
+	for(std::map<RunImage, unordered_map<u64, u64> >::iterator it = coverage.begin(); it != coverage.end(); ++it)
+	{
+		u64 bytes = 0;
+		u64 added = 0;
+		std::map<RunImage, unordered_map<u64, u64> >::iterator prev = coverage.end();
+		if(it->first.first > 0) prev = coverage.find(RunImage(it->first.first - 1, it->first.second));
+		for(unordered_map<u64, u64>::iterator t = it->second.begin(); t != it->second.end(); ++t)
+		{
+			bytes += t->second;
+			if(prev == coverage.end() || prev->second.find(t->first) == prev->second.end()) added++;
+		}
+		printf("%zu %s %zu %llu %llu\n", it->first.first + 1, it->first.second.c_str(), it->second.size(), bytes, added);
+	}
+	printf("# eof\n");
+}
+
+/* ================================================================= */
+/* ---------------------------- Periods ---------------------------- */
+// Budget_Array of dime_fini(): budget left at the end of each period, negative: overshoot
+static void report_periods(const string& path)
+{
+	FILE* in = fopen(path.c_str(), "r");
+	if(in == NULL)
+	{
+		cerr << "Cannot open " << path << endl;
+		exit(1);
+	}
+	char line[4096];
+	long long budget = -1;
+	vector<long long> left;
+	bool in_array = false;
+	while(fgets(line, sizeof(line), in) != NULL)
+	{
+		if(!in_array && sscanf(line, "#begin (BUDGET = %lldns)", &budget) == 1)
+		{
+			in_array = true;
+			continue;
+		}
+		if(!in_array) continue;
+		if(strncmp(line, "#eof", 4) == 0) break;
+		char* end;
+		long long v = strtoll(line, &end, 10);
+		if(end != line && (*end == '\n' || *end == '\0')) left.push_back(v);
+	}
+	fclose(in);
+	printf("# periods (%s)\n", path.c_str());
+	if(budget <= 0 || left.empty())
+	{
+		printf("no Budget_Array\n# eof\n");
+		return;
+	}
+	vector<double> overshoot;
+	double used = 0;
+	for(size_t i = 0; i < left.size(); i++)
+	{
+		used += (double)(budget - left[i]) / budget;
+		if(left[i] < 0) overshoot.push_back((double)-left[i] / budget * 100);
+	}
+	sort(overshoot.begin(), overshoot.end());
+	printf("budget_ns %lld periods %zu mean_used %.4f overshoot_periods %zu\n", budget, left.size(), used / left.size(), overshoot.size());
+	if(!overshoot.empty())
+	{
+		size_t n = overshoot.size();
+		printf("overshoot_pct p50 %.3f p90 %.3f p99 %.3f max %.3f\n", overshoot[(n - 1) / 2], overshoot[(n - 1) * 90 / 100],
+		       overshoot[(n - 1) * 99 / 100], overshoot[n - 1]);
+	}
+	printf("# eof\n");
+}
+
+/* ----------------------------------------------------------------- */
+int main(int argc, char** argv)
+{
+	vector<string> call_files, branch_files, log_dirs, pintool_logs;
+	unsigned threads = thread::hardware_concurrency();
+	size_t top = 20;
+	for(int i = 1; i < argc; i++)
+	{
+		string opt = argv[i];
+		if(i + 1 >= argc) opt = "";
+		if(opt == "-c") call_files.push_back(argv[++i]);
+		else if(opt == "-b") branch_files.push_back(argv[++i]);
+		else if(opt == "-l") log_dirs.push_back(argv[++i]);
+		else if(opt == "-p") pintool_logs.push_back(argv[++i]);
+		else if(opt == "-j") threads = atoi(argv[++i]);
+		else if(opt == "-n") top = atoi(argv[++i]);
+		else
+		{
+			cerr << "usage: " << argv[0] << " [-j threads] [-n top] [-c call_trace]... [-b branch_trace]... [-l log_dir]... [-p pintool.log]..." << endl;
+			return 1;
+		}
+	}
+	if(threads == 0) threads = 1;
+	if(!call_files.empty()) report_calls(call_files, threads, top);
+	if(!branch_files.empty()) report_branches(branch_files, threads, top);
+	if(!log_dirs.empty()) report_logs(log_dirs, threads);
+	for(size_t i = 0; i < pintool_logs.size(); i++) report_periods(pintool_logs[i]);
+	return 0;
+}
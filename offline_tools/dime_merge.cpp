@@ -0,0 +1,117 @@
+/*
+	Merges the per-thread output shards of a DIME tool (dime_shard_printf)
+	into one trace ordered by time stamp (k-way merge).
+
+	Each shard line is: 16 hex digits of rdtsc, a space, the record.
+	Each shard is already ordered, so the merge keeps one line per shard in a heap.
+
+	To compile:  g++ -O2 -o dime_merge dime_merge.cpp
+	To run:      dime_merge [-k] output_file shard_file...
+	             e.g. dime_merge call_dime.out call_dime.out.*
+	             -k: keep the time stamp and add the shard index: "tsc shard record"
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <queue>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+struct Head
+{
+	unsigned long long Tsc;
+	size_t Shard;//index in the shard list
+	bool operator>(const Head& other) const
+	{
+		//ties are ordered by shard, so that the merge is deterministic
+		return Tsc > other.Tsc || (Tsc == other.Tsc && Shard > other.Shard);
+	}
+};
+
+/* ----------------------------------------------------------------- */
+// reads the next record of a shard, returns false at the end of the shard
+// lines without a time stamp (e.g. truncated last line) are skipped
+static bool next_record(ifstream& in, unsigned long long* tsc, string* record)
+{
+	string line;
+	while(getline(in, line))
+	{
+		if(line.size() < 17 || line[16] != ' ') continue;
+		char* end;
+		*tsc = strtoull(line.substr(0, 16).c_str(), &end, 16);
+		if(*end != '\0') continue;
+		*record = line.substr(17);
+		return true;
+	}
+	return false;
+}
+
+/* ----------------------------------------------------------------- */
+int main(int argc, char** argv)
+{
+	bool keep_stamps = false;
+	int arg = 1;
+	if(arg < argc && strcmp(argv[arg], "-k") == 0)
+	{
+		keep_stamps = true;
+		arg++;
+	}
+	if(argc - arg < 2)
+	{
+		cerr << "usage: " << argv[0] << " [-k] output_file shard_file..." << endl;
+		return 1;
+	}
+	FILE* out = fopen(argv[arg++], "w");
+	if(out == NULL)
+	{
+		cerr << "Cannot open " << argv[arg - 1] << endl;
+		return 1;
+	}
+	size_t num_shards = argc - arg;
+	vector<ifstream*> shards(num_shards);
+	vector<string> records(num_shards);
+	priority_queue<Head, vector<Head>, greater<Head> > heap;
+	for(size_t i = 0; i < num_shards; i++)
+	{
+		shards[i] = new ifstream(argv[arg + i]);
+		if(!shards[i]->is_open())
+		{
+			cerr << "Cannot open " << argv[arg + i] << endl;
+			return 1;
+		}
+		Head h;
+		h.Shard = i;
+		if(next_record(*shards[i], &h.Tsc, &records[i]))
+		{
+			heap.push(h);
+		}
+	}
+	unsigned long long count = 0;
+	while(!heap.empty())
+	{
+		Head h = heap.top();
+		heap.pop();
+		if(keep_stamps)
+			fprintf(out, "%016llx %zu %s\n", h.Tsc, h.Shard, records[h.Shard].c_str());
+		else
+			fprintf(out, "%s\n", records[h.Shard].c_str());
+		count++;
+		if(next_record(*shards[h.Shard], &h.Tsc, &records[h.Shard]))
+		{
+			heap.push(h);
+		}
+	}
+	fprintf(out, "# eof");
+	fclose(out);
+	for(size_t i = 0; i < num_shards; i++)
+	{
+		delete shards[i];
+	}
+	cerr << count << " records merged from " << num_shards << " shards" << endl;
+	return 0;
+}